@@ -0,0 +1,66 @@
+/* Barrier latency benchmark, built against lib/libc.a by "make bench".
+ * Usage: bench/barrier [-r rounds] [threads...]
+ * For each thread count (default 2 4 8 16 32 64), the threads pass
+ * through a default and then a tree barrier the given number of times
+ * and the mean time per round is reported. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+static pthread_barrier_t bar;
+static long rounds = 10000;
+
+static void *work(void *arg)
+{
+	long i;
+
+	for (i=0; i<rounds; i++)
+		pthread_barrier_wait(&bar);
+	return 0;
+}
+
+static void run(const char *name, int kind, int nthreads)
+{
+	pthread_barrierattr_t a;
+	pthread_t *td = calloc(nthreads, sizeof *td);
+	struct timespec t0, t1;
+	double dt;
+	int i;
+
+	pthread_barrierattr_init(&a);
+	pthread_barrierattr_setkind_np(&a, kind);
+	pthread_barrier_init(&bar, &a, nthreads);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i=0; i<nthreads; i++)
+		pthread_create(td+i, 0, work, 0);
+	for (i=0; i<nthreads; i++)
+		pthread_join(td[i], 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_barrier_destroy(&bar);
+	free(td);
+	dt = t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	printf("%-7s %3d threads %8.2f us/round\n",
+		name, nthreads, dt / rounds * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	static const int def[] = { 2, 4, 8, 16, 32, 64 };
+	int i, n;
+
+	if (argc > 2 && argv[1][0] == '-' && argv[1][1] == 'r') {
+		rounds = atol(argv[2]);
+		argc -= 2, argv += 2;
+	}
+	if (rounds < 1) rounds = 1;
+	for (i=0; i < (argc > 1 ? argc-1 : 6); i++) {
+		n = argc > 1 ? atoi(argv[i+1]) : def[i];
+		if (n < 1) continue;
+		run("default", PTHREAD_BARRIER_DEFAULT_NP, n);
+		run("tree", PTHREAD_BARRIER_TREE_NP, n);
+	}
+	return 0;
+}
@@ -0,0 +1,265 @@
+/* Allocator benchmark, built against lib/libc.a by "make bench".
+ * Usage: bench/malloc [-n ops] [-t threads] [workload...]
+ * Each workload reports throughput, resident set size after the run
+ * and the minor/major faults it caused. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+static long nops = 1000000;
+static int nthreads = 4;
+
+static uint64_t rnd(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void touch(char *p, size_t n)
+{
+	size_t i;
+	for (i=0; i<n; i+=4096) p[i] = i;
+	if (n) p[n-1] = 1;
+}
+
+static void churn(uint64_t seed, long ops, size_t max)
+{
+	void *slot[1024] = { 0 };
+	long i;
+	int j;
+
+	for (i=0; i<ops; i++) {
+		j = rnd(&seed) % 1024;
+		free(slot[j]);
+		slot[j] = malloc(1 + rnd(&seed) % max);
+		*(char *)slot[j] = 0;
+	}
+	for (j=0; j<1024; j++) free(slot[j]);
+}
+
+static long small(void)
+{
+	churn(1, nops, 512);
+	return nops;
+}
+
+static void *churn_thread(void *arg)
+{
+	churn((uintptr_t)arg, nops / nthreads, 512);
+	return 0;
+}
+
+static long threads(void)
+{
+	pthread_t td[nthreads];
+	int i;
+
+	for (i=0; i<nthreads; i++)
+		pthread_create(td+i, 0, churn_thread, (void *)(uintptr_t)(i+1));
+	for (i=0; i<nthreads; i++)
+		pthread_join(td[i], 0);
+	return nops / nthreads * nthreads;
+}
+
+#define RING 4096
+
+struct ring {
+	void *slot[RING];
+	volatile unsigned long head, tail;
+	long ops;
+};
+
+static void *consumer(void *arg)
+{
+	struct ring *r = arg;
+	unsigned long t = 0;
+
+	while (t < r->ops) {
+		while (r->head == t) sched_yield();
+		__sync_synchronize();
+		free(r->slot[t++ % RING]);
+		r->tail = t;
+	}
+	return 0;
+}
+
+static void *producer(void *arg)
+{
+	struct ring *r = arg;
+	uint64_t seed = (uintptr_t)arg;
+	unsigned long h;
+	pthread_t td;
+
+	pthread_create(&td, 0, consumer, r);
+	for (h=0; h<r->ops; ) {
+		while (h - r->tail == RING) sched_yield();
+		r->slot[h % RING] = malloc(1 + rnd(&seed) % 1024);
+		__sync_synchronize();
+		r->head = ++h;
+	}
+	pthread_join(td, 0);
+	return 0;
+}
+
+static long xfree(void)
+{
+	int i, n = nthreads/2 ? nthreads/2 : 1;
+	struct ring *r = calloc(n, sizeof *r);
+	pthread_t td[n];
+
+	for (i=0; i<n; i++) {
+		r[i].ops = nops / n;
+		pthread_create(td+i, 0, producer, r+i);
+	}
+	for (i=0; i<n; i++)
+		pthread_join(td[i], 0);
+	free(r);
+	return nops / n * n;
+}
+
+static long grow(void)
+{
+	long i, ops = 0;
+	size_t n;
+	char *p, *q;
+
+	for (i=0; ops<nops/10; i++) {
+		p = 0;
+		for (n=16; n<1<<20; n+=n/4+1, ops++) {
+			if (!(q = realloc(p, n))) abort();
+			p = q;
+			p[n-1] = 0;
+		}
+		free(p);
+	}
+	return ops;
+}
+
+static long large(void)
+{
+	uint64_t seed = 1;
+	void *slot[8] = { 0 };
+	long i, ops = nops/1000;
+	size_t n;
+	int j;
+
+	for (i=0; i<ops; i++) {
+		j = rnd(&seed) % 8;
+		free(slot[j]);
+		n = (256<<10) + rnd(&seed) % (4<<20);
+		touch(slot[j] = malloc(n), n);
+	}
+	for (j=0; j<8; j++) free(slot[j]);
+	return ops;
+}
+
+/* A long-lived population that is gradually replaced while short-lived
+ * objects of other sizes churn around it, leaving holes behind. */
+static long frag(void)
+{
+	static void *live[65536];
+	void *tmp[64] = { 0 };
+	uint64_t seed = 1;
+	long i;
+	int j;
+
+	for (i=0; i<nops; i++) {
+		if (i % 8) {
+			j = rnd(&seed) % 64;
+			free(tmp[j]);
+			tmp[j] = malloc(1 + rnd(&seed) % 8192);
+		} else {
+			j = rnd(&seed) % 65536;
+			free(live[j]);
+			live[j] = malloc(16 + rnd(&seed) % 240);
+		}
+	}
+	for (j=0; j<64; j++) free(tmp[j]);
+	for (j=0; j<65536; j++) free(live[j]), live[j] = 0;
+	return nops;
+}
+
+static long rss_kb(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long pages = 0, rss = 0;
+
+	if (!f) return -1;
+	if (fscanf(f, "%ld %ld", &pages, &rss) != 2) rss = -1;
+	fclose(f);
+	return rss < 0 ? -1 : rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static const struct {
+	const char *name;
+	long (*run)(void);
+} tests[] = {
+	{ "small", small },
+	{ "threads", threads },
+	{ "xfree", xfree },
+	{ "realloc", grow },
+	{ "large", large },
+	{ "frag", frag },
+};
+
+#define NTESTS (int)(sizeof tests / sizeof *tests)
+
+static void run(int i)
+{
+	struct timespec t0, t1;
+	struct rusage r0, r1;
+	double dt;
+	long ops;
+
+	getrusage(RUSAGE_SELF, &r0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ops = tests[i].run();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	getrusage(RUSAGE_SELF, &r1);
+	dt = t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	printf("%-8s %10ld ops %8.3f s %12.0f ops/s rss %7ld kB"
+		" minflt %7ld majflt %ld\n",
+		tests[i].name, ops, dt, ops / dt, rss_kb(),
+		r1.ru_minflt - r0.ru_minflt, r1.ru_majflt - r0.ru_majflt);
+}
+
+int main(int argc, char **argv)
+{
+	struct rusage ru;
+	int c, i, j;
+
+	while ((c = getopt(argc, argv, "n:t:")) != -1) {
+		switch (c) {
+		case 'n': nops = atol(optarg); break;
+		case 't': nthreads = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n ops] [-t threads] [workload...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nops < 100) nops = 100;
+	if (nthreads < 1) nthreads = 1;
+	if (optind == argc) {
+		for (i=0; i<NTESTS; i++) run(i);
+	} else for (; optind<argc; optind++) {
+		for (j=0; j<NTESTS && strcmp(argv[optind], tests[j].name); j++);
+		if (j == NTESTS) {
+			fprintf(stderr, "%s: unknown workload\n", argv[optind]);
+			return 1;
+		}
+		run(j);
+	}
+	getrusage(RUSAGE_SELF, &ru);
+	printf("maxrss %ld kB\n", ru.ru_maxrss);
+	return 0;
+}
@@ -0,0 +1,126 @@
+/* Priority inversion latency test, built against lib/libc.a by
+ * "make bench". Needs permission to use SCHED_FIFO.
+ * Usage: bench/pi [-n iterations]
+ * All threads run on one CPU. A low-priority thread holds a mutex for
+ * HOLD ms, a high-priority thread then blocks on it, and a
+ * medium-priority thread spins for SPIN ms. Without priority
+ * inheritance the high thread waits for the spinner too; with it, the
+ * wait is bounded by the hold time. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define HOLD 20
+#define SPIN 100
+
+static pthread_mutex_t m;
+static volatile int held;
+static double waited;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void spin(double ms)
+{
+	double end = now() + ms / 1000;
+	while (now() < end);
+}
+
+static void *low(void *arg)
+{
+	pthread_mutex_lock(&m);
+	held = 1;
+	spin(HOLD);
+	pthread_mutex_unlock(&m);
+	return 0;
+}
+
+static void *medium(void *arg)
+{
+	spin(SPIN);
+	return 0;
+}
+
+static void *high(void *arg)
+{
+	double t = now();
+	pthread_mutex_lock(&m);
+	waited = now() - t;
+	pthread_mutex_unlock(&m);
+	return 0;
+}
+
+static int start(pthread_t *td, void *(*f)(void *), int prio)
+{
+	struct sched_param sp = { .sched_priority = prio };
+	pthread_attr_t a;
+
+	pthread_attr_init(&a);
+	pthread_attr_setinheritsched(&a, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&a, SCHED_FIFO);
+	pthread_attr_setschedparam(&a, &sp);
+	return pthread_create(td, &a, f, 0);
+}
+
+static int run(const char *name, int protocol, int iters)
+{
+	pthread_mutexattr_t a;
+	pthread_t l, h, md;
+	double sum = 0, max = 0;
+	int i, r;
+
+	pthread_mutexattr_init(&a);
+	if ((r = pthread_mutexattr_setprotocol(&a, protocol))) return r;
+	pthread_mutex_init(&m, &a);
+	for (i=0; i<iters; i++) {
+		held = 0;
+		if ((r = start(&l, low, 10))) return r;
+		while (!held) usleep(1000);
+		start(&h, high, 30);
+		start(&md, medium, 20);
+		pthread_join(h, 0);
+		pthread_join(md, 0);
+		pthread_join(l, 0);
+		sum += waited;
+		if (waited > max) max = waited;
+	}
+	pthread_mutex_destroy(&m);
+	printf("%-8s hold %d ms, spin %d ms: wait mean %7.3f ms max %7.3f ms\n",
+		name, HOLD, SPIN, sum / iters * 1000, max * 1000);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sched_param sp = { .sched_priority = 40 };
+	cpu_set_t set;
+	int iters = 10, cpu = 0, r;
+
+	if (argc > 2 && !strcmp(argv[1], "-n")) iters = atoi(argv[2]);
+	if (iters < 1) iters = 1;
+	if (!sched_getaffinity(0, sizeof set, &set))
+		while (cpu < CPU_SETSIZE-1 && !CPU_ISSET(cpu, &set)) cpu++;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof set, &set);
+	if ((r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))) {
+		fprintf(stderr, "SCHED_FIFO: %s\n", strerror(r));
+		return 1;
+	}
+	if ((r = run("none", PTHREAD_PRIO_NONE, iters))
+	 || (r = run("inherit", PTHREAD_PRIO_INHERIT, iters))) {
+		fprintf(stderr, "%s\n", strerror(r));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* Spinlock contention benchmark, built against lib/libc.a by "make bench".
+ * Usage: bench/spin [-s seconds] [threads...]
+ * For each thread count (default 2 4 8 16 32 64), threads take a
+ * test-and-set and then a ticket spinlock around a short critical
+ * section. Throughput is the total acquisitions per second; fairness
+ * is the least and most any one thread got, relative to the mean. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+static pthread_spinlock_t lock;
+static volatile int stop;
+static volatile long shared;
+static double secs = 0.5;
+
+struct worker {
+	pthread_t td;
+	long n;
+	char pad[64];
+};
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	long n = 0;
+	int i;
+
+	while (!stop) {
+		pthread_spin_lock(&lock);
+		for (i=0; i<16; i++) shared++;
+		pthread_spin_unlock(&lock);
+		n++;
+	}
+	w->n = n;
+	return 0;
+}
+
+static void run(const char *name, int kind, int nthreads)
+{
+	struct worker *w = calloc(nthreads, sizeof *w);
+	struct timespec ts = { secs, (secs - (long)secs) * 1e9 };
+	long sum = 0, min = -1, max = 0;
+	double mean;
+	int i;
+
+	pthread_spin_init(&lock, kind);
+	stop = 0;
+	for (i=0; i<nthreads; i++)
+		pthread_create(&w[i].td, 0, work, w+i);
+	nanosleep(&ts, 0);
+	stop = 1;
+	for (i=0; i<nthreads; i++) {
+		pthread_join(w[i].td, 0);
+		sum += w[i].n;
+		if (min < 0 || w[i].n < min) min = w[i].n;
+		if (w[i].n > max) max = w[i].n;
+	}
+	pthread_spin_destroy(&lock);
+	free(w);
+	mean = (double)sum / nthreads;
+	printf("%-7s %3d threads %12.0f locks/s min %5.2f max %5.2f of mean\n",
+		name, nthreads, sum / secs, min / mean, max / mean);
+}
+
+int main(int argc, char **argv)
+{
+	static const int def[] = { 2, 4, 8, 16, 32, 64 };
+	int i, n;
+
+	if (argc > 2 && argv[1][0] == '-' && argv[1][1] == 's') {
+		secs = atof(argv[2]);
+		argc -= 2, argv += 2;
+	}
+	if (secs <= 0) secs = 0.5;
+	for (i=0; i < (argc > 1 ? argc-1 : 6); i++) {
+		n = argc > 1 ? atoi(argv[i+1]) : def[i];
+		if (n < 1) continue;
+		run("tas", PTHREAD_PROCESS_PRIVATE, n);
+		run("ticket", PTHREAD_SPIN_TICKET_NP, n);
+	}
+	return 0;
+}
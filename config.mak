@@ -0,0 +1,23 @@
+# This version of config.mak was generated by:
+# ./configure
+# Any changes made here will be lost if configure is re-run
+ARCH = x86_64
+SUBARCH = 
+ASMSUBARCH = 
+prefix = /usr/local/musl
+exec_prefix = $(prefix)
+bindir = $(exec_prefix)/bin
+libdir = $(prefix)/lib
+includedir = $(prefix)/include
+syslibdir = /lib
+CC = gcc
+CFLAGS= -Os -pipe -fomit-frame-pointer -fno-unwind-tables -fno-asynchronous-unwind-tables -Wa,--noexecstack -Werror=implicit-function-declaration -Werror=implicit-int -Werror=pointer-sign -Werror=pointer-arith -fno-stack-protector 
+CFLAGS_C99FSE = -std=c99 -nostdinc -ffreestanding -fexcess-precision=standard -frounding-math
+CFLAGS_MEMOPS = -fno-tree-loop-distribute-patterns
+CPPFLAGS = 
+LDFLAGS = -Wl,--hash-style=both 
+CROSS_COMPILE = 
+LIBCC = -lgcc -lgcc_eh
+OPTIMIZE_GLOBS = internal/*.c malloc/*.c string/*.c
+ALL_TOOLS =
+TOOL_LIBS =
@@ -0,0 +1,53 @@
+#ifndef _MALLOC_H
+#define _MALLOC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __NEED_size_t
+#include <bits/alltypes.h>
+
+void *malloc (size_t);
+void *calloc (size_t, size_t);
+void *realloc (void *, size_t);
+void free (void *);
+void *valloc (size_t);
+void *memalign(size_t, size_t);
+
+struct mallinfo2 {
+	size_t arena;
+	size_t ordblks;
+	size_t smblks;
+	size_t hblks;
+	size_t hblkhd;
+	size_t usmblks;
+	size_t fsmblks;
+	size_t uordblks;
+	size_t fordblks;
+	size_t keepcost;
+};
+
+struct mallinfo2 mallinfo2(void);
+void malloc_stats(void);
+
+#define M_TRIM_THRESHOLD -1
+#define M_ARENA_MAX -8
+#define M_HUGEPAGES -9
+#define M_DECAY_TIME -10
+#define M_MADV_FREE -11
+#define M_SAMPLE_INTERVAL -12
+#define M_NUMA -13
+
+int mallopt(int, int);
+int malloc_trim(size_t);
+int malloc_dump_profile(int);
+
+size_t malloc_batch(size_t, void **, size_t);
+void free_batch(void **, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
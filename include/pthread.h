@@ -37,6 +37,18 @@ extern "C" {
 #define PTHREAD_MUTEX_DEFAULT 0
 #define PTHREAD_MUTEX_RECURSIVE 1
 #define PTHREAD_MUTEX_ERRORCHECK 2
+#ifdef _GNU_SOURCE
+#define PTHREAD_MUTEX_ADAPTIVE_NP 3
+#endif
+
+#ifdef _GNU_SOURCE
+#define PTHREAD_RWLOCK_PREFER_READER_NP 0
+#define PTHREAD_RWLOCK_PREFER_WRITER_NP 1
+#define PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP 2
+#define PTHREAD_SPIN_TICKET_NP 2
+#define PTHREAD_BARRIER_DEFAULT_NP 0
+#define PTHREAD_BARRIER_TREE_NP 1
+#endif
 
 #define PTHREAD_MUTEX_STALLED 0
 #define PTHREAD_MUTEX_ROBUST 1
@@ -214,6 +226,12 @@ struct cpu_set_t;
 int pthread_getaffinity_np(pthread_t, size_t, struct cpu_set_t *);
 int pthread_setaffinity_np(pthread_t, size_t, const struct cpu_set_t *);
 int pthread_getattr_np(pthread_t, pthread_attr_t *);
+int pthread_rwlockattr_setkind_np(pthread_rwlockattr_t *, int);
+int pthread_rwlockattr_getkind_np(const pthread_rwlockattr_t *__restrict, int *__restrict);
+int pthread_barrierattr_setkind_np(pthread_barrierattr_t *, int);
+int pthread_barrierattr_getkind_np(const pthread_barrierattr_t *__restrict, int *__restrict);
+int pthread_getattr_default_np(pthread_attr_t *);
+int pthread_setattr_default_np(const pthread_attr_t *);
 #endif
 
 #ifdef __cplusplus
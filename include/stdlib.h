@@ -40,6 +40,8 @@ void *calloc (size_t, size_t);
 void *realloc (void *, size_t);
 void free (void *);
 void *aligned_alloc(size_t alignment, size_t size);
+void free_sized(void *, size_t);
+void free_aligned_sized(void *, size_t, size_t);
 
 _Noreturn void abort (void);
 int atexit (void (*) (void));
@@ -4,6 +4,10 @@
 void __init_tls(size_t *);
 void __init_security(size_t *);
 void __init_ldso_ctors(void);
+void __init_default_attr(size_t *);
+
+static void dummy1(size_t *aux) {}
+weak_alias(dummy1, __init_default_attr);
 
 #ifndef SHARED
 static void dummy() {}
@@ -35,6 +39,7 @@ void __init_libc(char **envp, char *pn)
 
 	__init_tls(aux);
 	__init_security(aux);
+	__init_default_attr(aux);
 }
 
 int __libc_start_main(int (*main)(int,char **,char **), int argc, char **argv)
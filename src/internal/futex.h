@@ -12,6 +12,8 @@
 #define FUTEX_TRYLOCK_PI	8
 #define FUTEX_WAIT_BITSET	9
 
+#define FUTEX_PRIVATE 128
+
 #define FUTEX_CLOCK_REALTIME 256
 
 int __futex(volatile int *, int, int, void *);
@@ -0,0 +1,56 @@
+#ifndef _MALLOC_IMPL_H
+#define _MALLOC_IMPL_H
+
+#include <stdint.h>
+#include "libc.h"
+
+/* Small requests are served from fixed size-class slabs carved out of
+ * a single reserved address range, so a pointer can be recognized as a
+ * slab object without any per-object header. Until the range exists,
+ * __slab_base names the top of the address space, which never holds
+ * heap memory. */
+#define SLAB_SIZE 65536
+#define SLAB_MAX 256
+#define SLAB_SPAN (sizeof(size_t)>4 ? (size_t)1<<30 : (size_t)1<<25)
+
+extern uintptr_t __slab_base ATTR_LIBC_VISIBILITY;
+
+#define IS_SLAB(p) ((uintptr_t)(p) - __slab_base < SLAB_SPAN)
+
+#define SLAB_CLASSES 12
+#define MAX_ARENAS 64
+#define MAX_NODES 64
+
+/* Snapshot of the allocator's counters, for mallinfo2/malloc_stats.
+ * Arenas bound to NUMA node n are reported after the others, at
+ * MAX_ARENAS+n.
+ * Taken without locking, so totals are only approximately consistent
+ * while other threads are allocating. Chunks and objects held in
+ * per-thread caches count as in use. */
+struct malloc_stats {
+	size_t narenas;
+	struct {
+		size_t system, free_chunks, free_bytes;
+		size_t remote_chunks, remote_bytes;
+	} arena[MAX_ARENAS+MAX_NODES];
+	struct {
+		size_t chunks, bytes;
+	} bin[64];
+	struct {
+		size_t size, slabs, objs, inuse;
+	} slab[SLAB_CLASSES];
+	size_t mmap_chunks, mmap_bytes;
+	size_t contended;
+};
+
+void __malloc_stats(struct malloc_stats *) ATTR_LIBC_VISIBILITY;
+
+void *__malloc0(size_t) ATTR_LIBC_VISIBILITY;
+void *__malloc_aligned(size_t, size_t) ATTR_LIBC_VISIBILITY;
+
+/* Heap profiler hooks; sampled allocations are keyed by the base of
+ * their private mapping. */
+int __malloc_sample(void *, size_t, size_t, void *, void *) ATTR_LIBC_VISIBILITY;
+void __malloc_unsample(void *) ATTR_LIBC_VISIBILITY;
+
+#endif
@@ -18,11 +18,11 @@ struct pthread {
 	uintptr_t sysinfo;
 	uintptr_t canary;
 	pid_t tid, pid;
-	int tsd_used, errno_val, *errno_ptr;
+	int errno_val, *errno_ptr;
 	volatile int cancel, canceldisable, cancelasync;
 	int detached;
 	unsigned char *map_base;
-	size_t map_size;
+	size_t map_size, guard_size;
 	void *stack;
 	size_t stack_size;
 	void *start_arg;
@@ -30,6 +30,7 @@ struct pthread {
 	void *result;
 	struct __ptcb *cancelbuf;
 	void **tsd;
+	unsigned tsd_used[PTHREAD_KEYS_MAX/32];
 	pthread_attr_t attr;
 	volatile int dead;
 	struct {
@@ -40,6 +41,8 @@ struct pthread {
 	int unblock_cancel;
 	int timer_id;
 	locale_t locale;
+	void *malloc_tls;
+	void *malloc_arena;
 	int killlock[2];
 	int exitlock[2];
 	int startlock[2];
@@ -48,7 +51,11 @@ struct pthread {
 
 struct __timer {
 	int timerid;
-	pthread_t thread;
+	int state, overrun, pending;
+	uintptr_t key;
+	struct __timer *next;
+	void (*notify)(union sigval);
+	union sigval val;
 };
 
 #define __SU (sizeof(size_t)/sizeof(int))
@@ -66,22 +73,26 @@ struct __timer {
 #define _m_prev __u.__p[3]
 #define _m_next __u.__p[4]
 #define _m_count __u.__i[5]
-#define _c_mutex __u.__p[0]
+#define _c_shared __u.__p[0]
 #define _c_seq __u.__i[2]
 #define _c_waiters __u.__i[3]
 #define _c_clock __u.__i[4]
-#define _c_lock __u.__i[5]
-#define _c_lockwait __u.__i[6]
-#define _c_waiters2 __u.__i[7]
-#define _c_destroy __u.__i[8]
+#define _c_destroy __u.__i[5]
+#define _c_lock __u.__i[8]
+#define _c_head __u.__p[1]
+#define _c_tail __u.__p[5]
 #define _rw_lock __u.__i[0]
 #define _rw_waiters __u.__i[1]
+#define _rw_shared __u.__i[2]
+#define _rw_slots __u.__p[3]
+#define _rw_owner __u.__i[4]
 #define _b_lock __u.__i[0]
 #define _b_waiters __u.__i[1]
 #define _b_limit __u.__i[2]
 #define _b_count __u.__i[3]
 #define _b_waiters2 __u.__i[4]
 #define _b_inst __u.__p[3]
+#define _b_nodes __u.__p[3]
 
 #include "pthread_arch.h"
 
@@ -105,11 +116,57 @@ int __libc_sigaction(int, const struct sigaction *, struct sigaction *);
 int __libc_sigprocmask(int, const sigset_t *, sigset_t *);
 void __lock(volatile int *);
 void __unmapself(void *, size_t);
+int __stack_cache_put(struct pthread *);
+void __stack_cache_fork(void);
 
 int __timedwait(volatile int *, int, clockid_t, const struct timespec *, void (*)(void *), void *, int);
 void __wait(volatile int *, volatile int *, int, int);
-#define __wake(addr, cnt, priv) \
-	__syscall(SYS_futex, addr, FUTEX_WAKE, (cnt)<0?INT_MAX:(cnt))
+int __spin(volatile int *, int, volatile int *, volatile int *);
+int __private_cond_signal(pthread_cond_t *, int);
+int __pthread_mutex_taken(pthread_mutex_t *, int);
+
+/* Ticket spinlocks keep the ticket being served in the low 15 bits
+ * and the next ticket to hand out in the top 15. */
+#define SPIN_TICKET 0x10000
+#define SPIN_NEXT (1<<17)
+
+/* Tree barriers combine arrivals in nodes of up to BARRIER_FANOUT,
+ * each counting them in the low 16 bits of word below an epoch that
+ * advances when the node is released. */
+#define BARRIER_TREE 0x40000000
+#define BARRIER_FANOUT 4
+
+struct barrier_node {
+	volatile int word, waiters;
+	int cap, parent;
+	char pad[64-4*sizeof(int)];
+};
+
+#define RW_SLOTS 16
+#define RW_SLOT_INTS 16
+
+int __rwlock_dist_tryrdlock(pthread_rwlock_t *);
+int __rwlock_dist_timedrdlock(pthread_rwlock_t *__restrict, const struct timespec *__restrict);
+int __rwlock_dist_trywrlock(pthread_rwlock_t *);
+int __rwlock_dist_timedwrlock(pthread_rwlock_t *__restrict, const struct timespec *__restrict);
+int __rwlock_dist_unlock(pthread_rwlock_t *);
+
+/* Kernels before 2.6.22 reject FUTEX_PRIVATE with ENOSYS; all waiters
+ * on such a kernel then fall back to shared futexes alike. */
+static inline void __wake(volatile void *addr, int cnt, int priv)
+{
+	if (priv) priv = FUTEX_PRIVATE;
+	if (cnt<0) cnt = INT_MAX;
+	if (__syscall(SYS_futex, addr, FUTEX_WAKE|priv, cnt) == -ENOSYS)
+		__syscall(SYS_futex, addr, FUTEX_WAKE, cnt);
+}
+
+static inline void __futexwait(volatile void *addr, int val, int priv)
+{
+	if (priv) priv = FUTEX_PRIVATE;
+	if (__syscall(SYS_futex, addr, FUTEX_WAIT|priv, val, 0) == -ENOSYS)
+		__syscall(SYS_futex, addr, FUTEX_WAIT, val, 0);
+}
 
 void __acquire_ptc();
 void __release_ptc();
@@ -122,4 +179,6 @@ void __restore_sigs(void *);
 #define DEFAULT_STACK_SIZE 81920
 #define DEFAULT_GUARD_SIZE PAGE_SIZE
 
+extern pthread_attr_t __default_attr;
+
 #endif
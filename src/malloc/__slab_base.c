@@ -0,0 +1,3 @@
+#include "malloc_impl.h"
+
+uintptr_t __slab_base = -SLAB_SPAN;
@@ -0,0 +1,26 @@
+#include <malloc.h>
+#include "malloc_impl.h"
+
+struct mallinfo2 mallinfo2(void)
+{
+	struct malloc_stats st;
+	struct mallinfo2 mi = { 0 };
+	int i;
+
+	__malloc_stats(&st);
+	for (i=0; i<MAX_ARENAS+MAX_NODES; i++) {
+		mi.arena += st.arena[i].system;
+		mi.ordblks += st.arena[i].free_chunks + st.arena[i].remote_chunks;
+		mi.fordblks += st.arena[i].free_bytes + st.arena[i].remote_bytes;
+	}
+	for (i=0; i<SLAB_CLASSES; i++) {
+		mi.arena += st.slab[i].slabs * SLAB_SIZE;
+		mi.smblks += st.slab[i].objs - st.slab[i].inuse;
+		mi.fsmblks += (st.slab[i].objs - st.slab[i].inuse) * st.slab[i].size;
+	}
+	mi.fordblks += mi.fsmblks;
+	mi.uordblks = mi.arena - mi.fordblks;
+	mi.hblks = st.mmap_chunks;
+	mi.hblkhd = st.mmap_bytes;
+	return mi;
+}
@@ -1,13 +1,16 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
 #include <limits.h>
 #include <stdint.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <time.h>
 #include "libc.h"
 #include "atomic.h"
 #include "pthread_impl.h"
+#include "malloc_impl.h"
 
 #if defined(__GNUC__) && defined(__PIC__)
 #define inline inline __attribute__((always_inline))
@@ -18,6 +21,19 @@ void *__mmap(void *, size_t, int, int, int, off_t);
 int __munmap(void *, size_t);
 void *__mremap(void *, size_t, size_t, int, ...);
 int __madvise(void *, size_t, int);
+int __mprotect(void *, size_t, int);
+int __clock_gettime(clockid_t, struct timespec *);
+
+static int dummy_sample(void *base, size_t n, size_t interval, void *ra, void *fp)
+{
+	return 0;
+}
+weak_alias(dummy_sample, __malloc_sample);
+
+static void dummy_unsample(void *base)
+{
+}
+weak_alias(dummy_unsample, __malloc_unsample);
 
 struct chunk {
 	size_t psize, csize;
@@ -28,15 +44,78 @@ struct bin {
 	int lock[2];
 	struct chunk *head;
 	struct chunk *tail;
+	size_t count, bytes;
 };
 
-static struct {
-	uintptr_t brk;
-	size_t *heap;
+#define SLAB_BITS (8*sizeof(long))
+
+/* A slab is a SLAB_SIZE-aligned block holding objects of one size
+ * class, with a set bit in map for each free object. Slabs with free
+ * objects are kept on their class's list. */
+struct slab {
+	struct slab *next, *prev;
+	unsigned short cls, size, off, nobj, avail;
+	unsigned long map[];
+};
+
+struct slab_class {
+	int lock[2];
+	struct slab *head;
+	size_t slabs, objs, inuse;
+};
+
+static const unsigned short slab_size[SLAB_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+#define HUGE_PAGE_SIZE ((size_t)2<<20)
+#define SEG_SIZE HUGE_PAGE_SIZE
+
+/* The main arena grows by brk; other arenas, and the main arena
+ * once brk fails, grow by SEG_SIZE-aligned segments whose header
+ * names the owning arena. */
+struct arena {
 	uint64_t binmap;
 	struct bin bins[64];
-	int brk_lock[2];
 	int free_lock[2];
+	int top_lock[2];
+	uintptr_t top, end;
+	size_t mapped;
+	size_t dirty;
+	long long purged;
+	volatile int purging;
+	struct chunk *volatile remote;
+	volatile size_t remote_chunks, remote_bytes;
+	volatile int owners;
+	int node;
+};
+
+struct seg {
+	struct arena *arena;
+};
+
+static struct arena main_arena;
+
+static struct {
+	uintptr_t brk, brk_end;
+	size_t *heap;
+	int brk_lock[2];
+	struct arena *arenas[MAX_ARENAS];
+	struct arena *node_arenas[MAX_NODES];
+	unsigned narenas, next_arena;
+	int arena_lock[2];
+	int hugepages, numa;
+	struct slab_class slabs[SLAB_CLASSES];
+	uintptr_t slab_top, slab_end;
+	struct slab *slab_free, *slab_dirty;
+	size_t slab_ndirty;
+	long long slab_purged;
+	int slab_lock[2];
+	volatile size_t mmap_chunks, mmap_bytes;
+	volatile int contended;
+	long sample_interval, sample_left;
+	uint64_t sample_seed;
+	int sampled;
 } mal;
 
 
@@ -46,26 +125,52 @@ static struct {
 #define MMAP_THRESHOLD (0x1c00*SIZE_ALIGN)
 #define DONTCARE 16
 #define RECLAIM 163840
+#define CACHE_BINS 16
+#define CACHE_COUNT 16
+#define DECAY_MS 1000
+#define DIRTY_MAX ((size_t)4<<20)
 
-#define CHUNK_SIZE(c) ((c)->csize & -2)
-#define CHUNK_PSIZE(c) ((c)->psize & -2)
+#define CHUNK_SIZE(c) ((c)->csize & -4)
+#define CHUNK_PSIZE(c) ((c)->psize & -4)
 #define PREV_CHUNK(c) ((struct chunk *)((char *)(c) - CHUNK_PSIZE(c)))
 #define NEXT_CHUNK(c) ((struct chunk *)((char *)(c) + CHUNK_SIZE(c)))
 #define MEM_TO_CHUNK(p) (struct chunk *)((char *)(p) - OVERHEAD)
 #define CHUNK_TO_MEM(c) (void *)((char *)(c) + OVERHEAD)
-#define BIN_TO_CHUNK(i) (MEM_TO_CHUNK(&mal.bins[i].head))
+#define BIN_TO_CHUNK(a, i) (MEM_TO_CHUNK(&(a)->bins[i].head))
 
 #define C_INUSE  ((size_t)1)
+#define C_CLEAN  ((size_t)2)
 
 #define IS_MMAPPED(c) !((c)->csize & (C_INUSE))
 
+/* Freed memory is returned to the kernel lazily; see purge. */
+static struct {
+	int decay_ms, madv_free;
+	size_t dirty_max;
+} pol = { DECAY_MS, 0, DIRTY_MAX };
+
+/* Per-thread cache of small freed chunks, indexed by bin, and of
+ * slab objects, indexed by class. Cached chunks keep their in-use
+ * flags so they are never merged. */
+struct tcache {
+	struct chunk *head[CACHE_BINS];
+	void *slab[SLAB_CLASSES];
+	unsigned char count[CACHE_BINS];
+	unsigned char slab_count[SLAB_CLASSES];
+	long sample_left;
+	uint64_t sample_seed;
+};
+
 
 /* Synchronization tools */
 
 static inline void lock(volatile int *lk)
 {
-	if (libc.threads_minus_1)
-		while(a_swap(lk, 1)) __wait(lk, lk+1, 1, 1);
+	if (libc.threads_minus_1 && a_swap(lk, 1)) {
+		a_inc(&mal.contended);
+		do __wait(lk, lk+1, 1, 1);
+		while (a_swap(lk, 1));
+	}
 }
 
 static inline void unlock(volatile int *lk)
@@ -76,16 +181,23 @@ static inline void unlock(volatile int *lk)
 	}
 }
 
-static inline void lock_bin(int i)
+static inline void lock_bin(struct arena *a, int i)
+{
+	lock(a->bins[i].lock);
+	if (!a->bins[i].head)
+		a->bins[i].head = a->bins[i].tail = BIN_TO_CHUNK(a, i);
+}
+
+static inline void unlock_bin(struct arena *a, int i)
 {
-	lock(mal.bins[i].lock);
-	if (!mal.bins[i].head)
-		mal.bins[i].head = mal.bins[i].tail = BIN_TO_CHUNK(i);
+	unlock(a->bins[i].lock);
 }
 
-static inline void unlock_bin(int i)
+static void count(volatile size_t *p, long v)
 {
-	unlock(mal.bins[i].lock);
+	long old;
+	do old = *p;
+	while (a_cas_l(p, old, old+v) != old);
 }
 
 static int first_set(uint64_t x)
@@ -135,34 +247,212 @@ void __dump_heap(int x)
 {
 	struct chunk *c;
 	int i;
+	struct arena *a = &main_arena;
 	for (c = (void *)mal.heap; CHUNK_SIZE(c); c = NEXT_CHUNK(c))
 		fprintf(stderr, "base %p size %zu (%d) flags %d/%d\n",
 			c, CHUNK_SIZE(c), bin_index(CHUNK_SIZE(c)),
 			c->csize & 15,
 			NEXT_CHUNK(c)->psize & 15);
 	for (i=0; i<64; i++) {
-		if (mal.bins[i].head != BIN_TO_CHUNK(i) && mal.bins[i].head) {
-			fprintf(stderr, "bin %d: %p\n", i, mal.bins[i].head);
-			if (!(mal.binmap & 1ULL<<i))
+		if (a->bins[i].head != BIN_TO_CHUNK(a, i) && a->bins[i].head) {
+			fprintf(stderr, "bin %d: %p\n", i, a->bins[i].head);
+			if (!(a->binmap & 1ULL<<i))
 				fprintf(stderr, "missing from binmap!\n");
-		} else if (mal.binmap & 1ULL<<i)
+		} else if (a->binmap & 1ULL<<i)
 			fprintf(stderr, "binmap wrongly contains %d!\n", i);
 	}
 }
 #endif
 
-static struct chunk *expand_heap(size_t n)
+static int slab_class(size_t n)
+{
+	if (n <= 128) return n ? n-1>>4 : 0;
+	return (n-1>>5) + 4;
+}
+
+static struct slab *slab_new(int i)
+{
+	struct slab *s;
+	char *p;
+	int k;
+
+	lock(mal.slab_lock);
+	if ((s = mal.slab_dirty)) {
+		mal.slab_dirty = s->next;
+		mal.slab_ndirty -= SLAB_SIZE;
+	} else if ((s = mal.slab_free)) {
+		mal.slab_free = s->next;
+	} else {
+		if (!mal.slab_end) {
+			p = __mmap(0, SLAB_SPAN, PROT_NONE,
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+			if (p == MAP_FAILED) {
+				mal.slab_top = mal.slab_end = -1;
+			} else {
+				mal.slab_top = (uintptr_t)p + SLAB_SIZE-1 & -SLAB_SIZE;
+				mal.slab_end = (uintptr_t)p + SLAB_SPAN & -SLAB_SIZE;
+				a_store_l(&__slab_base, (uintptr_t)p);
+			}
+		}
+		if (mal.slab_top == mal.slab_end
+		 || __mprotect((void *)mal.slab_top, SLAB_SIZE, PROT_READ|PROT_WRITE)) {
+			unlock(mal.slab_lock);
+			return 0;
+		}
+		s = (void *)mal.slab_top;
+		mal.slab_top += SLAB_SIZE;
+	}
+	unlock(mal.slab_lock);
+
+	s->cls = i;
+	s->size = slab_size[i];
+	k = (SLAB_SIZE/s->size + SLAB_BITS-1) / SLAB_BITS;
+	s->off = sizeof *s + k*sizeof(long) + 63 & -64;
+	s->nobj = s->avail = (SLAB_SIZE - s->off) / s->size;
+	for (k=0; k<s->nobj/SLAB_BITS; k++) s->map[k] = -1;
+	if (s->nobj % SLAB_BITS) s->map[k] = (1UL<<s->nobj%SLAB_BITS) - 1;
+
+	s->prev = 0;
+	s->next = mal.slabs[i].head;
+	if (s->next) s->next->prev = s;
+	mal.slabs[i].head = s;
+	mal.slabs[i].slabs++;
+	mal.slabs[i].objs += s->nobj;
+	return s;
+}
+
+/* Must be called with the class lock held. */
+static void *slab_take(struct slab_class *sc, struct slab *s)
+{
+	int w, b;
+
+	for (w=0; !s->map[w]; w++);
+	b = a_ctz_l(s->map[w]);
+	s->map[w] &= s->map[w]-1;
+	sc->inuse++;
+	if (!--s->avail) {
+		sc->head = s->next;
+		if (sc->head) sc->head->prev = 0;
+	}
+	return (char *)s + s->off + (w*SLAB_BITS + b)*s->size;
+}
+
+static void *slab_alloc(int i)
+{
+	struct slab_class *sc = &mal.slabs[i];
+	struct slab *s;
+	void *p;
+
+	lock(sc->lock);
+	if (!(s = sc->head) && !(s = slab_new(i))) {
+		unlock(sc->lock);
+		return 0;
+	}
+	p = slab_take(sc, s);
+	unlock(sc->lock);
+	return p;
+}
+
+static size_t slab_alloc_batch(int i, void **p, size_t n)
+{
+	struct slab_class *sc = &mal.slabs[i];
+	struct slab *s;
+	size_t k;
+
+	lock(sc->lock);
+	for (k=0; k<n; k++) {
+		if (!(s = sc->head) && !(s = slab_new(i))) break;
+		p[k] = slab_take(sc, s);
+	}
+	unlock(sc->lock);
+	return k;
+}
+
+#define SLAB_OF(p) ((struct slab *)((uintptr_t)(p) & -SLAB_SIZE))
+#define SLAB_INDEX(s, p) (((char *)(p) - (char *)(s) - (s)->off) / (s)->size)
+#define SLAB_OBJ(s, k) ((void *)((char *)(s) + (s)->off + (k)*(s)->size))
+
+static int purge_slabs(int);
+
+static void slab_free(void *p)
+{
+	struct slab *s = SLAB_OF(p);
+	struct slab_class *sc = &mal.slabs[s->cls];
+	size_t k = SLAB_INDEX(s, p);
+	unsigned long bit = 1UL << k%SLAB_BITS;
+
+	/* Crash on pointers that are not the start of an object */
+	if (p != SLAB_OBJ(s, k)) a_crash();
+
+	lock(sc->lock);
+
+	/* Crash on double free */
+	if (s->map[k/SLAB_BITS] & bit) a_crash();
+	s->map[k/SLAB_BITS] |= bit;
+	sc->inuse--;
+
+	if (!s->avail++) {
+		s->prev = 0;
+		s->next = sc->head;
+		if (s->next) s->next->prev = s;
+		sc->head = s;
+	} else if (s->avail == s->nobj && (s->prev || s->next)) {
+		/* Keep one slab per class; other empty ones are given
+		 * back by the purge policy. */
+		if (s->prev) s->prev->next = s->next;
+		else sc->head = s->next;
+		if (s->next) s->next->prev = s->prev;
+		sc->slabs--;
+		sc->objs -= s->nobj;
+		unlock(sc->lock);
+		lock(mal.slab_lock);
+		s->next = mal.slab_dirty;
+		mal.slab_dirty = s;
+		mal.slab_ndirty += SLAB_SIZE;
+		unlock(mal.slab_lock);
+		purge_slabs(0);
+		return;
+	}
+
+	unlock(sc->lock);
+}
+
+/* Huge pages are opt-in, by MALLOC_HUGEPAGES or mallopt. */
+static int use_hugepages(void)
+{
+	char *e;
+	if (!mal.hugepages) {
+		e = getenv("MALLOC_HUGEPAGES");
+		mal.hugepages = e && *e && *e != '0' ? 1 : -1;
+	}
+	return mal.hugepages > 0;
+}
+
+static struct chunk *expand_brk(size_t n)
 {
 	struct chunk *w;
 	uintptr_t new;
+	size_t align = use_hugepages() ? HUGE_PAGE_SIZE : PAGE_SIZE;
 
 	lock(mal.brk_lock);
 
-	if (n > SIZE_MAX - mal.brk - 2*PAGE_SIZE) goto fail;
-	new = mal.brk + n + SIZE_ALIGN + PAGE_SIZE - 1 & -PAGE_SIZE;
-	n = new - mal.brk;
-
-	if (__brk(new) != new) goto fail;
+	/* Like a segment, the brk heap is carved exactly, so that memory
+	 * past mal.brk has never been used and the next chunk carved
+	 * from it is known to be zero. */
+	if (n > SIZE_MAX - mal.brk - 2*align) goto fail;
+	new = mal.brk + n;
+	if (new > mal.brk_end) {
+		uintptr_t end = new + align - 1 & -align;
+		if (__brk(end) != end) {
+			if (!mal.heap) mal.brk = 0;
+			goto fail;
+		}
+		if (align != PAGE_SIZE) {
+			uintptr_t old = mal.brk_end + PAGE_SIZE-1 & -PAGE_SIZE;
+			__madvise((void *)old, end-old, MADV_HUGEPAGE);
+		}
+		mal.brk_end = end;
+	}
 
 	w = MEM_TO_CHUNK(new);
 	w->psize = n | C_INUSE;
@@ -170,8 +460,12 @@ static struct chunk *expand_heap(size_t n)
 
 	w = MEM_TO_CHUNK(mal.brk);
 	w->csize = n | C_INUSE;
+	if (!mal.heap) {
+		w->psize = 0 | C_INUSE;
+		mal.heap = (void *)w;
+	}
 	mal.brk = new;
-	
+
 	unlock(mal.brk_lock);
 
 	return w;
@@ -181,11 +475,199 @@ fail:
 	return 0;
 }
 
-static int init_malloc(size_t n)
+static void bin_chunk(struct arena *, struct chunk *);
+static void maybe_purge(struct arena *);
+
+static void *map_aligned(size_t len, size_t align)
+{
+	size_t extra = align - PAGE_SIZE;
+	char *p = __mmap(0, len + extra, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	uintptr_t s;
+	if (p == MAP_FAILED) return p;
+	s = (uintptr_t)p + align-1 & -align;
+	if (s != (uintptr_t)p) __munmap(p, s - (uintptr_t)p);
+	if (s != (uintptr_t)p + extra)
+		__munmap((void *)(s + len), (uintptr_t)p + extra - s);
+	return (void *)s;
+}
+
+/* NUMA placement is opt-in, by MALLOC_NUMA or mallopt. */
+static int use_numa(void)
+{
+	char *e;
+	if (!mal.numa) {
+		e = getenv("MALLOC_NUMA");
+		mal.numa = e && *e && *e != '0' ? 1 : -1;
+	}
+	return mal.numa > 0;
+}
+
+#define MPOL_PREFERRED 1
+#define LONG_BITS (8*sizeof(long))
+
+/* Segments of an arena bound to a node (stored as node+1) prefer that
+ * node; the policy is set before the segment is first touched. */
+static void *map_seg(int node)
+{
+	unsigned long mask[MAX_NODES/LONG_BITS] = { 0 };
+	void *p = map_aligned(SEG_SIZE, SEG_SIZE);
+	if (p == MAP_FAILED) return 0;
+	if (use_hugepages()) __madvise(p, SEG_SIZE, MADV_HUGEPAGE);
+	if (node--) {
+		mask[node/LONG_BITS] = 1UL << node%LONG_BITS;
+		__syscall(SYS_mbind, p, SEG_SIZE, MPOL_PREFERRED,
+			mask, MAX_NODES+1, 0);
+	}
+	return p;
+}
+
+static void init_seg(struct arena *a, struct seg *s, size_t hdr)
+{
+	struct chunk *w;
+	s->arena = a;
+	a->mapped += SEG_SIZE;
+	a->top = (uintptr_t)s + hdr + OVERHEAD + SIZE_ALIGN-1 & -SIZE_ALIGN;
+	a->end = (uintptr_t)s + SEG_SIZE;
+	w = MEM_TO_CHUNK(a->top);
+	w->psize = w->csize = 0 | C_INUSE;
+}
+
+/* Must be called with the arena's top_lock held and at least n
+ * bytes left in the current segment. */
+static struct chunk *carve(struct arena *a, size_t n)
+{
+	struct chunk *w;
+	uintptr_t new = a->top + n;
+
+	w = MEM_TO_CHUNK(new);
+	w->psize = n | C_INUSE;
+	w->csize = 0 | C_INUSE;
+
+	w = MEM_TO_CHUNK(a->top);
+	w->csize = n | C_INUSE;
+	a->top = new;
+	return w;
+}
+
+static struct chunk *expand_seg(struct arena *a, size_t n)
+{
+	struct chunk *w, *rest = 0;
+	struct seg *s;
+
+	lock(a->top_lock);
+	if (n > a->end - a->top) {
+		if (!(s = map_seg(a->node))) {
+			unlock(a->top_lock);
+			errno = ENOMEM;
+			return 0;
+		}
+		/* Hand whatever is left of the old segment to the bins. */
+		if (a->end - a->top >= SIZE_ALIGN)
+			rest = carve(a, a->end - a->top & SIZE_MASK);
+		init_seg(a, s, sizeof *s);
+	}
+	w = carve(a, n);
+	unlock(a->top_lock);
+
+	if (rest) bin_chunk(a, rest);
+	return w;
+}
+
+static struct chunk *expand_heap(struct arena *a, size_t n)
+{
+	struct chunk *c;
+	if (a == &main_arena && mal.brk && (c = expand_brk(n)))
+		return c;
+	return expand_seg(a, n);
+}
+
+static struct arena *new_arena(int node)
+{
+	struct seg *s = map_seg(node);
+	if (!s) return 0;
+	/* Keep the arena's 64-bit binmap naturally aligned. */
+	init_seg((void *)((char *)s + SIZE_ALIGN), s,
+		SIZE_ALIGN + sizeof(struct arena));
+	s->arena->node = node;
+	return s->arena;
+}
+
+static struct arena *pick_arena(void)
+{
+	struct arena *a;
+	unsigned long set[128/sizeof(long)], x;
+	unsigned cpu, node;
+	char *e;
+	int i, n;
+
+	lock(mal.arena_lock);
+	if (!mal.narenas) {
+		n = (e = getenv("MALLOC_ARENAS")) ? atoi(e) : 0;
+		if (n <= 0) {
+			i = __syscall(SYS_sched_getaffinity, 0, sizeof set, set);
+			for (i = i>0 ? i/sizeof(long) : 0; i--; )
+				for (x=set[i]; x; x&=x-1) n++;
+		}
+		if (n < 1) n = 1;
+		if (n > MAX_ARENAS) n = MAX_ARENAS;
+		mal.narenas = n;
+	}
+	/* In NUMA mode, node n has an arena of its own, kept apart from
+	 * the unbound ones, that serves every thread that first
+	 * allocates while running there. */
+	if (use_numa() && !__syscall(SYS_getcpu, &cpu, &node, 0)
+	 && node < MAX_NODES) {
+		if (!(a = mal.node_arenas[node])
+		 && !(a = mal.node_arenas[node] = new_arena(node+1)))
+			a = &main_arena;
+		unlock(mal.arena_lock);
+		return a;
+	}
+	/* The main thread has arena 0, so others start at 1 */
+	i = ++mal.next_arena % mal.narenas;
+	if (!i) a = &main_arena;
+	else if (!(a = mal.arenas[i]) && !(a = mal.arenas[i] = new_arena(0)))
+		a = &main_arena;
+	unlock(mal.arena_lock);
+	return a;
+}
+
+static struct arena *get_arena(void)
+{
+	struct pthread *self;
+	struct arena *a;
+	if (!libc.threaded) return &main_arena;
+	self = __pthread_self();
+	/* The main thread keeps the arena that holds everything it
+	 * allocated before the first thread was created. */
+	if (!(a = self->malloc_arena)) {
+		if (self == libc.main_thread) a = &main_arena;
+		else a = pick_arena();
+		self->malloc_arena = a;
+		a_inc(&a->owners);
+	}
+	return a;
+}
+
+/* Arenas by index: main, the unbound ones, then those of each node */
+static struct arena *arena_at(int i)
+{
+	if (i >= MAX_ARENAS) return mal.node_arenas[i-MAX_ARENAS];
+	return i ? mal.arenas[i] : &main_arena;
+}
+
+static struct arena *arena_of(struct chunk *c)
+{
+	uintptr_t h = (uintptr_t)mal.heap;
+	if (h && (uintptr_t)c - h < mal.brk - h) return &main_arena;
+	return ((struct seg *)((uintptr_t)c & -SEG_SIZE))->arena;
+}
+
+static int init_malloc(void)
 {
 	static int init, waiters;
 	int state;
-	struct chunk *c;
 
 	if (init == 2) return 0;
 
@@ -196,24 +678,12 @@ static int init_malloc(size_t n)
 		return 0;
 	}
 
-	mal.brk = __brk(0);
+	mal.brk = mal.brk_end = __brk(0);
 #ifdef SHARED
 	mal.brk = mal.brk + PAGE_SIZE-1 & -PAGE_SIZE;
 #endif
 	mal.brk = mal.brk + 2*SIZE_ALIGN-1 & -SIZE_ALIGN;
 
-	c = expand_heap(n);
-
-	if (!c) {
-		a_store(&init, 0);
-		if (waiters) __wake(&init, 1, 1);
-		return -1;
-	}
-
-	mal.heap = (void *)c;
-	c->psize = 0 | C_INUSE;
-	free(CHUNK_TO_MEM(c));
-
 	a_store(&init, 2);
 	if (waiters) __wake(&init, -1, 1);
 	return 1;
@@ -235,46 +705,48 @@ static int adjust_size(size_t *n)
 	return 0;
 }
 
-static void unbin(struct chunk *c, int i)
+static void unbin(struct arena *a, struct chunk *c, int i)
 {
 	if (c->prev == c->next)
-		a_and_64(&mal.binmap, ~(1ULL<<i));
+		a_and_64(&a->binmap, ~(1ULL<<i));
+	a->bins[i].count--;
+	a->bins[i].bytes -= CHUNK_SIZE(c);
 	c->prev->next = c->next;
 	c->next->prev = c->prev;
-	c->csize |= C_INUSE;
-	NEXT_CHUNK(c)->psize |= C_INUSE;
+	c->csize = c->csize & ~C_CLEAN | C_INUSE;
+	NEXT_CHUNK(c)->psize = c->csize;
 }
 
-static int alloc_fwd(struct chunk *c)
+static int alloc_fwd(struct arena *a, struct chunk *c)
 {
 	int i;
 	size_t k;
 	while (!((k=c->csize) & C_INUSE)) {
 		i = bin_index(k);
-		lock_bin(i);
+		lock_bin(a, i);
 		if (c->csize == k) {
-			unbin(c, i);
-			unlock_bin(i);
+			unbin(a, c, i);
+			unlock_bin(a, i);
 			return 1;
 		}
-		unlock_bin(i);
+		unlock_bin(a, i);
 	}
 	return 0;
 }
 
-static int alloc_rev(struct chunk *c)
+static int alloc_rev(struct arena *a, struct chunk *c)
 {
 	int i;
 	size_t k;
 	while (!((k=c->psize) & C_INUSE)) {
 		i = bin_index(k);
-		lock_bin(i);
+		lock_bin(a, i);
 		if (c->psize == k) {
-			unbin(PREV_CHUNK(c), i);
-			unlock_bin(i);
+			unbin(a, PREV_CHUNK(c), i);
+			unlock_bin(a, i);
 			return 1;
 		}
-		unlock_bin(i);
+		unlock_bin(a, i);
 	}
 	return 0;
 }
@@ -307,13 +779,13 @@ static int pretrim(struct chunk *self, size_t n, int i, int j)
 	split->prev->next = split;
 	split->next->prev = split;
 	split->psize = n | C_INUSE;
-	split->csize = n1-n;
-	next->psize = n1-n;
+	split->csize = n1-n | self->csize & C_CLEAN;
+	next->psize = split->csize;
 	self->csize = n | C_INUSE;
 	return 1;
 }
 
-static void trim(struct chunk *self, size_t n)
+static void trim(struct arena *a, struct chunk *self, size_t n)
 {
 	size_t n1 = CHUNK_SIZE(self);
 	struct chunk *next, *split;
@@ -328,67 +800,370 @@ static void trim(struct chunk *self, size_t n)
 	next->psize = n1-n | C_INUSE;
 	self->csize = n | C_INUSE;
 
-	free(CHUNK_TO_MEM(split));
+	bin_chunk(a, split);
 }
 
-void *malloc(size_t n)
+/* Chunks freed by threads not using their arena are queued on it
+ * without locking, keeping their in-use flags, and binned in a batch
+ * by the next malloc from that arena. */
+static void queue_remote(struct arena *a, struct chunk *c)
 {
-	struct chunk *c;
-	int i, j;
+	struct chunk *head;
 
-	if (adjust_size(&n) < 0) return 0;
+	/* Crash on corrupted footer (likely from buffer overflow) */
+	if (NEXT_CHUNK(c)->psize != c->csize) a_crash();
 
-	if (n > MMAP_THRESHOLD) {
-		size_t len = n + OVERHEAD + PAGE_SIZE - 1 & -PAGE_SIZE;
-		char *base = __mmap(0, len, PROT_READ|PROT_WRITE,
+	count(&a->remote_chunks, 1);
+	count(&a->remote_bytes, CHUNK_SIZE(c));
+	do c->next = head = a->remote;
+	while (a_cas_p(&a->remote, head, c) != head);
+}
+
+static void drain(struct arena *a)
+{
+	struct chunk *c, *next;
+	size_t n = 0, bytes = 0;
+
+	do c = a->remote;
+	while (a_cas_p(&a->remote, c, 0) != c);
+	for (; c; c=next) {
+		next = c->next;
+		n++;
+		bytes += CHUNK_SIZE(c);
+		bin_chunk(a, c);
+	}
+	count(&a->remote_chunks, -n);
+	count(&a->remote_bytes, -bytes);
+}
+
+static void *map_chunk(size_t n)
+{
+	size_t len = n + OVERHEAD + PAGE_SIZE - 1 & -PAGE_SIZE;
+	struct chunk *c;
+	char *base;
+
+	if (len >= HUGE_PAGE_SIZE && use_hugepages()) {
+		base = map_aligned(len, HUGE_PAGE_SIZE);
+		if (base != (void *)-1)
+			__madvise(base, len, MADV_HUGEPAGE);
+	} else {
+		base = __mmap(0, len, PROT_READ|PROT_WRITE,
 			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-		if (base == (void *)-1) return 0;
-		c = (void *)(base + SIZE_ALIGN - OVERHEAD);
-		c->csize = len - (SIZE_ALIGN - OVERHEAD);
-		c->psize = SIZE_ALIGN - OVERHEAD;
-		return CHUNK_TO_MEM(c);
 	}
+	if (base == (void *)-1) return 0;
+	count(&mal.mmap_chunks, 1);
+	count(&mal.mmap_bytes, len);
+	c = (void *)(base + SIZE_ALIGN - OVERHEAD);
+	c->csize = len - (SIZE_ALIGN - OVERHEAD);
+	c->psize = SIZE_ALIGN - OVERHEAD;
+	return CHUNK_TO_MEM(c);
+}
+
+/* Heap profiling samples one allocation per sample_interval bytes on
+ * average. Intervals are drawn from an exponential distribution so
+ * that the sampled set is unbiased with respect to allocation size;
+ * -log(u) comes from the float representation of u, as in bin_index. */
+static long next_sample(uint64_t *seed)
+{
+	uint32_t r;
+	float l;
+
+	*seed = *seed * 6364136223846793005ULL + 1;
+	r = *seed >> 32 | 1;
+	l = ((union { float v; uint32_t r; }){ r }.r - (127<<23)) / (float)(1<<23);
+	return (32 - l) * 0.693147f * mal.sample_interval + 1;
+}
+
+static int sample_due(size_t n)
+{
+	long *left = &mal.sample_left;
+	uint64_t *seed = &mal.sample_seed;
+	char *e;
+
+	if (!mal.sample_interval) {
+		e = getenv("MALLOC_SAMPLE_INTERVAL");
+		mal.sample_interval = e && atol(e) > 0 ? atol(e) : -1;
+		mal.sample_seed = (uintptr_t)&e;
+	}
+	if (mal.sample_interval < 0) return 0;
+	/* Once threaded, each thread draws its own sample points, and
+	 * one without a cache is not sampled. */
+	if (libc.threaded) {
+		struct tcache *tc = __pthread_self()->malloc_tls;
+		if (!tc) return 0;
+		left = &tc->sample_left;
+		seed = &tc->sample_seed;
+		if (!*seed) *seed = mal.sample_seed
+			^ (uint64_t)__pthread_self()->tid << 32 ^ (uintptr_t)tc;
+	}
+	if (!*left) *left = next_sample(seed);
+	if ((*left -= n) > 0) return 0;
+	*left = next_sample(seed);
+	return 1;
+}
 
+/* Sampled allocations get a mapping of their own, so free only has
+ * to consult the profiler on the munmap path. malloc's frame is the
+ * start of the frame pointer chain for the backtrace. */
+static void *sampled_malloc(size_t n, void *ra, void *fp)
+{
+	size_t m = n;
+	char *p;
+
+	if (adjust_size(&m) < 0 || !(p = map_chunk(m))) return 0;
+	if (__malloc_sample(p - SIZE_ALIGN, n, mal.sample_interval, ra, fp))
+		mal.sampled = 1;
+	return p;
+}
+
+/* An arena that goes idle after freeing has no frees left to run its
+ * decay, so growing the heap, where its dirty pages cost the most,
+ * runs it for every arena. */
+static void decay(void)
+{
+	struct arena *a;
+	int i;
+
+	if (pol.decay_ms <= 0) return;
+	for (i=0; i<MAX_ARENAS+MAX_NODES; i++)
+		if ((a = arena_at(i))) maybe_purge(a);
+	purge_slabs(0);
+}
+
+/* If dirty is not null, it receives the number of bytes at the start
+ * of the chunk that may not be zero; memory new to the heap is. */
+static struct chunk *arena_alloc(struct arena *a, size_t n, size_t *dirty)
+{
+	struct chunk *c;
+	size_t d = -1;
+	int i, j;
+
+	if (a->remote) drain(a);
 	i = bin_index_up(n);
 	for (;;) {
-		uint64_t mask = mal.binmap & -(1ULL<<i);
+		uint64_t mask = a->binmap & -(1ULL<<i);
 		if (!mask) {
-			if (init_malloc(n) > 0) continue;
-			c = expand_heap(n);
+			if (a == &main_arena && init_malloc() > 0) continue;
+			decay();
+			c = expand_heap(a, n);
 			if (!c) return 0;
-			if (alloc_rev(c)) {
+			d = 0;
+			if (alloc_rev(a, c)) {
 				struct chunk *x = c;
 				c = PREV_CHUNK(c);
+				d = CHUNK_SIZE(c);
 				NEXT_CHUNK(x)->psize = c->csize =
 					x->csize + CHUNK_SIZE(c);
 			}
 			break;
 		}
 		j = first_set(mask);
-		lock_bin(j);
-		c = mal.bins[j].head;
-		if (c != BIN_TO_CHUNK(j) && j == bin_index(c->csize)) {
-			if (!pretrim(c, n, i, j)) unbin(c, j);
-			unlock_bin(j);
+		lock_bin(a, j);
+		c = a->bins[j].head;
+		if (c != BIN_TO_CHUNK(a, j) && j == bin_index(c->csize)) {
+			if (pretrim(c, n, i, j)) a->bins[j].bytes -= n;
+			else unbin(a, c, j);
+			unlock_bin(a, j);
 			break;
 		}
-		unlock_bin(j);
+		unlock_bin(a, j);
 	}
 
 	/* Now patch up in case we over-allocated */
-	trim(c, n);
+	trim(a, c, n);
+
+	if (dirty) *dirty = d;
+	return c;
+}
+
+void *malloc(size_t n)
+{
+	struct chunk *c;
+	int i;
+
+	if (mal.sample_interval >= 0 && sample_due(n))
+		return sampled_malloc(n, __builtin_return_address(0),
+			__builtin_frame_address(0));
+
+	if (n <= SLAB_MAX) {
+		void *p;
+		i = slab_class(n);
+		if (libc.threaded) {
+			struct tcache *tc = __pthread_self()->malloc_tls;
+			if (tc && (p = tc->slab[i])) {
+				tc->slab[i] = *(void **)p;
+				tc->slab_count[i]--;
+				return p;
+			}
+		}
+		if ((p = slab_alloc(i))) return p;
+	}
+
+	if (adjust_size(&n) < 0) return 0;
+
+	if (n <= CACHE_BINS*SIZE_ALIGN && libc.threaded) {
+		struct tcache *tc = __pthread_self()->malloc_tls;
+		i = bin_index(n);
+		if (tc && (c = tc->head[i])) {
+			tc->head[i] = c->next;
+			tc->count[i]--;
+			return CHUNK_TO_MEM(c);
+		}
+	}
+
+	if (n > MMAP_THRESHOLD) return map_chunk(n);
+
+	c = arena_alloc(get_arena(), n, 0);
+	return c ? CHUNK_TO_MEM(c) : 0;
+}
+
+/* Only write words that are not already zero */
+static void clear(size_t *z, size_t n)
+{
+	for (n = (n + sizeof *z - 1)/sizeof *z; n; n--, z++) if (*z) *z=0;
+}
+
+#define ALIGN_TRIES 16
 
+/* Memory for an alignment above SIZE_ALIGN starts the distance gap
+ * into a chunk, which always leaves room for a chunk in front. */
+#define GAP(c, align) (-(uintptr_t)CHUNK_TO_MEM(c) & (align)-1)
+
+/* Look through the bins for a chunk with room for n bytes at an
+ * aligned address, so that a previously aligned chunk is reused as it
+ * is, and split off whatever is in front of that address. */
+static struct chunk *arena_alloc_aligned(struct arena *a, size_t n, size_t align)
+{
+	struct chunk *c, *next, *r;
+	size_t g, k;
+	int j;
+
+	if (a->remote) drain(a);
+	for (j=bin_index(n); j<64; j++) {
+		if (!(a->binmap & 1ULL<<j)) continue;
+		lock_bin(a, j);
+		for (c=a->bins[j].head, k=0; c!=BIN_TO_CHUNK(a, j)
+		     && k<ALIGN_TRIES; c=c->next, k++) {
+			if (GAP(c, align) + n <= CHUNK_SIZE(c)) {
+				unbin(a, c, j);
+				unlock_bin(a, j);
+				goto found;
+			}
+		}
+		unlock_bin(a, j);
+	}
+	if (!(c = arena_alloc(a, n + align, 0))) return 0;
+
+found:
+	if ((g = GAP(c, align))) {
+		next = NEXT_CHUNK(c);
+		r = (void *)((char *)c + g);
+		r->csize = next->psize = CHUNK_SIZE(c) - g | C_INUSE;
+		c->csize = r->psize = g | C_INUSE;
+		bin_chunk(a, c);
+		c = r;
+	}
+	trim(a, c, n);
+	return c;
+}
+
+/* Unmap whole pages on either side of the aligned chunk. */
+static void *map_chunk_aligned(size_t align, size_t n)
+{
+	size_t len = n + align + SIZE_ALIGN + PAGE_SIZE - 1 & -PAGE_SIZE;
+	uintptr_t p, mem, base, end;
+	struct chunk *c;
+
+	p = (uintptr_t)__mmap(0, len, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == -1) return 0;
+	mem = p + SIZE_ALIGN + align - 1 & -align;
+	base = mem - SIZE_ALIGN & -PAGE_SIZE;
+	end = mem + n + PAGE_SIZE - 1 & -PAGE_SIZE;
+	if (base != p) __munmap((void *)p, base - p);
+	if (end != p + len) __munmap((void *)end, p + len - end);
+	count(&mal.mmap_chunks, 1);
+	count(&mal.mmap_bytes, end - base);
+	c = MEM_TO_CHUNK(mem);
+	c->psize = (uintptr_t)c - base;
+	c->csize = end - (uintptr_t)c;
+	return (void *)mem;
+}
+
+/* Aligned allocation for memalign and friends, for alignments above
+ * what malloc already guarantees. Slab classes whose objects fall on
+ * the alignment are used directly; chunks are found aligned in the
+ * bins rather than over-allocated. Neither is sampled for profiling. */
+void *__malloc_aligned(size_t align, size_t n)
+{
+	struct chunk *c;
+	size_t m = n;
+	void *p;
+	int i;
+
+	/* Slab objects start 64-byte aligned within their slab */
+	if (n <= SLAB_MAX && align <= 64) {
+		for (i=slab_class(n > align ? n : align); i<SLAB_CLASSES; i++)
+			if (slab_size[i] % align == 0) break;
+		if (i < SLAB_CLASSES && (p = slab_alloc(i))) return p;
+	}
+
+	if (adjust_size(&m) < 0) return 0;
+	if (align > PTRDIFF_MAX - m) {
+		errno = ENOMEM;
+		return 0;
+	}
+	if (m > MMAP_THRESHOLD || align > MMAP_THRESHOLD - m)
+		return map_chunk_aligned(align, m);
+	if (!(c = arena_alloc_aligned(get_arena(), m, align))) return 0;
 	return CHUNK_TO_MEM(c);
 }
 
+/* Zeroed allocation for calloc. Chunks taken from the arena directly
+ * are cleared only where they may have been used before; others are
+ * cleared unless they are mmapped, and so fresh from the kernel. */
+void *__malloc0(size_t n)
+{
+	struct chunk *c;
+	size_t m = n, dirty;
+	void *p;
+
+	if (n <= SLAB_MAX || adjust_size(&m) < 0
+	 || m <= CACHE_BINS*SIZE_ALIGN || m > MMAP_THRESHOLD) {
+		if (!(p = malloc(n))) return 0;
+		if (IS_SLAB(p) || !IS_MMAPPED(MEM_TO_CHUNK(p))) clear(p, n);
+		return p;
+	}
+
+	if (mal.sample_interval >= 0 && sample_due(n))
+		return sampled_malloc(n, __builtin_return_address(0),
+			__builtin_frame_address(0));
+
+	if (!(c = arena_alloc(get_arena(), m, &dirty))) return 0;
+	p = CHUNK_TO_MEM(c);
+	clear(p, dirty < n ? dirty : n);
+	return p;
+}
+
 void *realloc(void *p, size_t n)
 {
+	struct arena *a;
 	struct chunk *self, *next;
 	size_t n0, n1;
 	void *new;
 
 	if (!p) return malloc(n);
 
+	if (IS_SLAB(p)) {
+		struct slab *s = SLAB_OF(p);
+		n0 = (char *)SLAB_OBJ(s, SLAB_INDEX(s, p)+1) - (char *)p;
+		if (n <= n0) return p;
+		if (!(new = malloc(n))) return 0;
+		memcpy(new, p, n0);
+		free(p);
+		return new;
+	}
+
 	if (adjust_size(&n) < 0) return 0;
 
 	self = MEM_TO_CHUNK(p);
@@ -408,14 +1183,17 @@ void *realloc(void *p, size_t n)
 		}
 		newlen = (newlen + PAGE_SIZE-1) & -PAGE_SIZE;
 		if (oldlen == newlen) return p;
+		if (mal.sampled) __malloc_unsample(base);
 		base = __mremap(base, oldlen, newlen, MREMAP_MAYMOVE);
 		if (base == (void *)-1)
 			return newlen < oldlen ? p : 0;
+		count(&mal.mmap_bytes, newlen - oldlen);
 		self = (void *)(base + extra);
 		self->csize = newlen - extra;
 		return CHUNK_TO_MEM(self);
 	}
 
+	a = arena_of(self);
 	next = NEXT_CHUNK(self);
 
 	/* Crash on corrupted footer (likely from buffer overflow) */
@@ -424,12 +1202,12 @@ void *realloc(void *p, size_t n)
 	/* Merge adjacent chunks if we need more space. This is not
 	 * a waste of time even if we fail to get enough space, because our
 	 * subsequent call to free would otherwise have to do the merge. */
-	if (n > n1 && alloc_fwd(next)) {
+	if (n > n1 && alloc_fwd(a, next)) {
 		n1 += CHUNK_SIZE(next);
 		next = NEXT_CHUNK(next);
 	}
 	/* FIXME: find what's wrong here and reenable it..? */
-	if (0 && n > n1 && alloc_rev(self)) {
+	if (0 && n > n1 && alloc_rev(a, self)) {
 		self = PREV_CHUNK(self);
 		n1 += CHUNK_SIZE(self);
 	}
@@ -439,7 +1217,7 @@ void *realloc(void *p, size_t n)
 	/* If we got enough space, split off the excess and return */
 	if (n <= n1) {
 		//memmove(CHUNK_TO_MEM(self), p, n0-OVERHEAD);
-		trim(self, n);
+		trim(a, self, n);
 		return CHUNK_TO_MEM(self);
 	}
 
@@ -451,58 +1229,155 @@ void *realloc(void *p, size_t n)
 	return new;
 }
 
-void free(void *p)
+/* Replace the middle of a free chunk with fresh zero pages (or, with
+ * MADV_FREE, pages the kernel may reclaim). With huge pages, only
+ * whole huge pages are released so that partial frees do not split
+ * them. */
+static void discard_pages(void *p, size_t len)
 {
-	struct chunk *self = MEM_TO_CHUNK(p);
-	struct chunk *next;
-	size_t final_size, new_size, size;
-	int reclaim=0;
+	if (pol.madv_free && !__madvise(p, len, MADV_FREE)) return;
+	__madvise(p, len, MADV_DONTNEED);
+}
+
+static void discard(struct chunk *self, struct chunk *next)
+{
+	size_t align = use_hugepages() ? HUGE_PAGE_SIZE : PAGE_SIZE;
+	uintptr_t a = (uintptr_t)self + SIZE_ALIGN+align-1 & -align;
+	uintptr_t b = (uintptr_t)next - SIZE_ALIGN & -align;
+	if (a < b) discard_pages((void *)a, b-a);
+}
+
+/* Discard the pages of all large free chunks in an arena. Rather than
+ * doing this on every free that produces a large free chunk, free
+ * counts the bytes freed to an arena and purges once that exceeds
+ * dirty_max, or once decay_ms has passed since the last purge, so
+ * that large buffers freed and soon reallocated are not refaulted.
+ * Discarded chunks are binned again with C_CLEAN, which lasts until
+ * they are allocated or merged, and later purges skip them. */
+static int purge(struct arena *a, long long now)
+{
+	struct chunk *c, *n, *b, *list;
+	size_t size = 0;
 	int i;
 
-	if (!p) return;
+	if (a_swap(&a->purging, 1)) return 0;
+	lock(a->free_lock);
+	a->dirty = 0;
+	a->purged = now;
+	unlock(a->free_lock);
+	/* Each bin's chunks are taken out as if allocated, so nothing
+	 * can reuse them while the bin is unlocked for the madvise, and
+	 * then binned again. Going from the top, chunks that merge on
+	 * the way back land in bins already done. */
+	for (i=63; i>=bin_index(RECLAIM); i--) {
+		if (!(a->binmap & 1ULL<<i)) continue;
+		lock_bin(a, i);
+		/* unbin writes the head through the sentinel chunk, so it
+		 * must be read back the same way. */
+		b = BIN_TO_CHUNK(a, i);
+		for (list=0, c=b->next; c != b; c=n) {
+			n = c->next;
+			if (c->csize & C_CLEAN) continue;
+			unbin(a, c, i);
+			c->next = list;
+			list = c;
+		}
+		unlock_bin(a, i);
+		while ((c = list)) {
+			list = c->next;
+			discard(c, NEXT_CHUNK(c));
+			size += CHUNK_SIZE(c);
+			c->csize |= C_CLEAN;
+			NEXT_CHUNK(c)->psize = c->csize;
+			bin_chunk(a, c);
+		}
+	}
+	a_store(&a->purging, 0);
+	return size > 0;
+}
 
-	if (IS_MMAPPED(self)) {
-		size_t extra = self->psize;
-		char *base = (char *)self - extra;
-		size_t len = CHUNK_SIZE(self) + extra;
-		/* Crash on double free */
-		if (extra & 1) a_crash();
-		__munmap(base, len);
-		return;
+static long long now_ms(void)
+{
+	struct timespec ts;
+	__clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+/* Empty slabs are discarded on the same terms as an arena's pages,
+ * or unconditionally when forced. They stay on the dirty list, ready
+ * for reuse without faults, until then. */
+static int purge_slabs(int force)
+{
+	struct slab *s, *list, *clean, *last;
+	long long now = now_ms();
+
+	lock(mal.slab_lock);
+	if (!mal.slab_purged) mal.slab_purged = now;
+	if (!mal.slab_ndirty || !force && mal.slab_ndirty < pol.dirty_max
+	 && (pol.decay_ms < 0 || now - mal.slab_purged < pol.decay_ms)) {
+		unlock(mal.slab_lock);
+		return 0;
 	}
+	list = mal.slab_dirty;
+	mal.slab_dirty = 0;
+	mal.slab_ndirty = 0;
+	mal.slab_purged = now;
+	unlock(mal.slab_lock);
+
+	for (clean=last=0; (s = list); clean=s) {
+		list = s->next;
+		discard_pages(s, SLAB_SIZE);
+		s->next = clean;
+		if (!last) last = s;
+	}
+	lock(mal.slab_lock);
+	last->next = mal.slab_free;
+	mal.slab_free = clean;
+	unlock(mal.slab_lock);
+	return 1;
+}
+
+static void maybe_purge(struct arena *a)
+{
+	long long now = now_ms();
+	int due;
+
+	lock(a->free_lock);
+	if (a->dirty && !a->purged) a->purged = now;
+	due = a->dirty && (a->dirty >= pol.dirty_max
+		|| pol.decay_ms >= 0 && now - a->purged >= pol.decay_ms);
+	unlock(a->free_lock);
+	if (due) purge(a, now);
+}
+
+static void bin_chunk(struct arena *a, struct chunk *self)
+{
+	struct chunk *next;
+	size_t final_size, new_size, size, clean;
+	int reclaim=0;
+	int i;
 
 	final_size = new_size = CHUNK_SIZE(self);
+	clean = self->csize & C_CLEAN;
 	next = NEXT_CHUNK(self);
 
 	/* Crash on corrupted footer (likely from buffer overflow) */
 	if (next->psize != self->csize) a_crash();
 
 	for (;;) {
-		/* Replace middle of large chunks with fresh zero pages */
-		if (reclaim && (self->psize & next->csize & C_INUSE)) {
-			uintptr_t a = (uintptr_t)self + SIZE_ALIGN+PAGE_SIZE-1 & -PAGE_SIZE;
-			uintptr_t b = (uintptr_t)next - SIZE_ALIGN & -PAGE_SIZE;
-#if 1
-			__madvise((void *)a, b-a, MADV_DONTNEED);
-#else
-			__mmap((void *)a, b-a, PROT_READ|PROT_WRITE,
-				MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
-#endif
-		}
-
 		if (self->psize & next->csize & C_INUSE) {
 			self->csize = final_size | C_INUSE;
 			next->psize = final_size | C_INUSE;
 			i = bin_index(final_size);
-			lock_bin(i);
-			lock(mal.free_lock);
+			lock_bin(a, i);
+			lock(a->free_lock);
 			if (self->psize & next->csize & C_INUSE)
 				break;
-			unlock(mal.free_lock);
-			unlock_bin(i);
+			unlock(a->free_lock);
+			unlock_bin(a, i);
 		}
 
-		if (alloc_rev(self)) {
+		if (alloc_rev(a, self)) {
 			self = PREV_CHUNK(self);
 			size = CHUNK_SIZE(self);
 			final_size += size;
@@ -510,7 +1385,7 @@ void free(void *p)
 				reclaim = 1;
 		}
 
-		if (alloc_fwd(next)) {
+		if (alloc_fwd(a, next)) {
 			size = CHUNK_SIZE(next);
 			final_size += size;
 			if (new_size+size > RECLAIM && (new_size+size^size) > size)
@@ -519,17 +1394,299 @@ void free(void *p)
 		}
 	}
 
-	self->csize = final_size;
-	next->psize = final_size;
-	unlock(mal.free_lock);
+	/* Only a purged chunk binned again whole stays clean. */
+	if (final_size != new_size) clean = 0;
+	self->csize = next->psize = final_size | clean;
+	if (!clean) a->dirty += new_size;
+	unlock(a->free_lock);
 
-	self->next = BIN_TO_CHUNK(i);
-	self->prev = mal.bins[i].tail;
+	self->next = BIN_TO_CHUNK(a, i);
+	self->prev = a->bins[i].tail;
 	self->next->prev = self;
 	self->prev->next = self;
+	a->bins[i].count++;
+	a->bins[i].bytes += final_size;
+
+	if (!(a->binmap & 1ULL<<i))
+		a_or_64(&a->binmap, 1ULL<<i);
+
+	unlock_bin(a, i);
+
+	if (reclaim) maybe_purge(a);
+}
+
+static struct tcache *new_tcache(struct pthread *self)
+{
+	/* malloc never creates the cache, so this cannot recurse. */
+	struct tcache *tc = malloc(sizeof *tc);
+	if (tc) {
+		memset(tc, 0, sizeof *tc);
+		self->malloc_tls = tc;
+	}
+	return tc;
+}
+
+static int cache_put(void *p)
+{
+	struct pthread *self = __pthread_self();
+	struct tcache *tc = self->malloc_tls;
+	struct chunk *c = MEM_TO_CHUNK(p);
+	struct arena *a;
+	int i;
+
+	if (IS_SLAB(p)) {
+		struct slab *s = SLAB_OF(p);
+		i = s->cls;
+		if (!tc && !(tc = new_tcache(self))) return 0;
+		if (tc->slab_count[i] >= CACHE_COUNT) return 0;
+		if (p != SLAB_OBJ(s, SLAB_INDEX(s, p))) a_crash();
+		*(void **)p = tc->slab[i];
+		tc->slab[i] = p;
+		tc->slab_count[i]++;
+		return 1;
+	}
+
+	if (IS_MMAPPED(c) || CHUNK_SIZE(c) > CACHE_BINS*SIZE_ALIGN)
+		return 0;
+	/* Send chunks from other nodes home rather than reusing them. */
+	if (mal.numa > 0 && (a = arena_of(c))->node && a != self->malloc_arena)
+		return 0;
+	i = bin_index(CHUNK_SIZE(c));
+	if (!tc && !(tc = new_tcache(self))) return 0;
+	if (tc->count[i] >= CACHE_COUNT) return 0;
+
+	/* Crash on corrupted footer (likely from buffer overflow) */
+	if (NEXT_CHUNK(c)->psize != c->csize) a_crash();
+
+	c->next = tc->head[i];
+	tc->head[i] = c;
+	tc->count[i]++;
+	return 1;
+}
+
+static void release(void *p)
+{
+	struct chunk *self = MEM_TO_CHUNK(p);
+	struct arena *a;
+
+	if (IS_SLAB(p)) {
+		slab_free(p);
+		return;
+	}
+
+	if (IS_MMAPPED(self)) {
+		size_t extra = self->psize;
+		char *base = (char *)self - extra;
+		size_t len = CHUNK_SIZE(self) + extra;
+		/* Crash on double free */
+		if (extra & 1) a_crash();
+		if (mal.sampled) __malloc_unsample(base);
+		__munmap(base, len);
+		count(&mal.mmap_chunks, -1);
+		count(&mal.mmap_bytes, -len);
+		return;
+	}
+
+	a = arena_of(self);
+	/* In NUMA mode, only arenas bound to a node have owners. An
+	 * arena whose owners have all exited would never be drained.
+	 * Freeing never assigns the caller an arena of its own. */
+	if (libc.threaded && a != __pthread_self()->malloc_arena && a->owners
+	 && (mal.numa <= 0 || a->node)) {
+		queue_remote(a, self);
+		/* The last owner may have left and drained the queue
+		 * between the check above and the push. */
+		if (!a->owners) drain(a);
+	} else bin_chunk(a, self);
+}
+
+void free(void *p)
+{
+	if (!p) return;
+	if (libc.threaded && cache_put(p)) return;
+	release(p);
+}
+
+/* The sizes offer no shortcut: free reads the chunk header anyway to
+ * check the footer, and a chunk's size class cannot be told from the
+ * requested size, since splitting, memalign and realloc all leave
+ * chunks larger than asked for. Alignment needs no handling either,
+ * since aligned allocations are freed like any other. */
+void free_sized(void *p, size_t n)
+{
+	free(p);
+}
+
+void free_aligned_sized(void *p, size_t align, size_t n)
+{
+	free(p);
+}
+
+/* Small sizes are taken from their slab class under one lock. Others
+ * are carved, up to MMAP_THRESHOLD bytes at a time, from one arena
+ * chunk that is then split into adjacent in-use chunks. */
+size_t malloc_batch(size_t size, void **p, size_t n)
+{
+	struct chunk *c, *w, *end;
+	size_t i = 0, k, m = size;
+
+	if (size <= SLAB_MAX) i = slab_alloc_batch(slab_class(size), p, n);
+	if (i == n || adjust_size(&m) < 0) return i;
+	while (i < n) {
+		k = MMAP_THRESHOLD / m;
+		if (k > n-i) k = n-i;
+		if (k < 2) {
+			if (!(p[i] = malloc(size))) break;
+			i++;
+			continue;
+		}
+		if (!(c = arena_alloc(get_arena(), k*m, 0))) break;
+		end = NEXT_CHUNK(c);
+		for (; k>1; k--, c=w) {
+			w = (void *)((char *)c + m);
+			c->csize = w->psize = m | C_INUSE;
+			p[i++] = CHUNK_TO_MEM(c);
+		}
+		c->csize = end->psize = (char *)end - (char *)c | C_INUSE;
+		p[i++] = CHUNK_TO_MEM(c);
+	}
+	return i;
+}
+
+/* Runs of adjacent chunks, as from malloc_batch, are merged while
+ * still in use and binned once. */
+void free_batch(void **p, size_t n)
+{
+	struct chunk *c, *next;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (!p[i]) continue;
+		c = MEM_TO_CHUNK(p[i]);
+		if (IS_SLAB(p[i]) || IS_MMAPPED(c)) {
+			free(p[i]);
+			continue;
+		}
+		while (i+1<n && (next = MEM_TO_CHUNK(p[i+1])) == NEXT_CHUNK(c)) {
+			/* Crash on double free or corrupted footer */
+			if (!(next->csize & C_INUSE)
+			 || NEXT_CHUNK(next)->psize != next->csize) a_crash();
+			c->csize = NEXT_CHUNK(next)->psize =
+				CHUNK_SIZE(c) + CHUNK_SIZE(next) | C_INUSE;
+			i++;
+		}
+		release(CHUNK_TO_MEM(c));
+	}
+}
+
+/* Called from pthread_exit to return cached chunks to the bins. */
+void __malloc_tls_flush()
+{
+	struct pthread *self = __pthread_self();
+	struct tcache *tc = self->malloc_tls;
+	struct arena *a = self->malloc_arena;
+	struct chunk *c;
+	void *p;
+	int i;
 
-	if (!(mal.binmap & 1ULL<<i))
-		a_or_64(&mal.binmap, 1ULL<<i);
+	if (tc) {
+		self->malloc_tls = 0;
+		for (i=0; i<CACHE_BINS; i++) {
+			while ((c = tc->head[i])) {
+				tc->head[i] = c->next;
+				bin_chunk(arena_of(c), c);
+			}
+		}
+		for (i=0; i<SLAB_CLASSES; i++) {
+			while ((p = tc->slab[i])) {
+				tc->slab[i] = *(void **)p;
+				slab_free(p);
+			}
+		}
+		release(tc);
+	}
+	/* Nobody else drains an arena's remote frees once its last
+	 * owning thread is gone, so the leaving thread does it. */
+	if (a && a_fetch_add(&a->owners, -1) == 1) drain(a);
+}
 
-	unlock_bin(i);
+int mallopt(int param, int value)
+{
+	switch (param) {
+	case M_ARENA_MAX:
+		if (value < 1) return 0;
+		lock(mal.arena_lock);
+		mal.narenas = value < MAX_ARENAS ? value : MAX_ARENAS;
+		unlock(mal.arena_lock);
+		return 1;
+	case M_HUGEPAGES:
+		mal.hugepages = value ? 1 : -1;
+		return 1;
+	case M_NUMA:
+		mal.numa = value ? 1 : -1;
+		return 1;
+	case M_TRIM_THRESHOLD:
+		if (value < 0) return 0;
+		pol.dirty_max = value;
+		return 1;
+	case M_DECAY_TIME:
+		pol.decay_ms = value;
+		return 1;
+	case M_MADV_FREE:
+		pol.madv_free = value;
+		return 1;
+	case M_SAMPLE_INTERVAL:
+		if (!mal.sample_seed) mal.sample_seed = (uintptr_t)&value;
+		mal.sample_interval = value > 0 ? value : -1;
+		return 1;
+	}
+	return 0;
+}
+
+/* Purges every arena now, regardless of decay. The heap itself is
+ * never shrunk, so pad has no effect. */
+int malloc_trim(size_t pad)
+{
+	long long now = now_ms();
+	struct arena *a;
+	int i, r = 0;
+
+	for (i=0; i<MAX_ARENAS+MAX_NODES; i++)
+		if ((a = arena_at(i))) {
+			drain(a);
+			r |= purge(a, now);
+		}
+	return purge_slabs(1) | r;
+}
+
+void __malloc_stats(struct malloc_stats *st)
+{
+	struct arena *a;
+	int i, j;
+
+	memset(st, 0, sizeof *st);
+	for (i=0; i<MAX_ARENAS+MAX_NODES; i++) {
+		if (!(a = arena_at(i))) continue;
+		st->narenas++;
+		st->arena[i].remote_chunks = a->remote_chunks;
+		st->arena[i].remote_bytes = a->remote_bytes;
+		st->arena[i].system = a->mapped;
+		if (!i && mal.heap)
+			st->arena[i].system += mal.brk_end - (uintptr_t)mal.heap;
+		for (j=0; j<64; j++) {
+			st->arena[i].free_chunks += a->bins[j].count;
+			st->arena[i].free_bytes += a->bins[j].bytes;
+			st->bin[j].chunks += a->bins[j].count;
+			st->bin[j].bytes += a->bins[j].bytes;
+		}
+	}
+	for (i=0; i<SLAB_CLASSES; i++) {
+		st->slab[i].size = slab_size[i];
+		st->slab[i].slabs = mal.slabs[i].slabs;
+		st->slab[i].objs = mal.slabs[i].objs;
+		st->slab[i].inuse = mal.slabs[i].inuse;
+	}
+	st->mmap_chunks = mal.mmap_chunks;
+	st->mmap_bytes = mal.mmap_bytes;
+	st->contended = (unsigned)mal.contended;
 }
@@ -0,0 +1,155 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "pthread_impl.h"
+#include "malloc_impl.h"
+#include "syscall.h"
+
+void *__mmap(void *, size_t, int, int, int, off_t);
+
+/* Live sampled allocations, in an open-addressed table keyed by the
+ * base of each allocation's mapping. The table is modified only with
+ * signals blocked, so a dump may be taken from a signal handler. */
+
+#define SLOTS 8192
+#define DEPTH 16
+
+static struct sample {
+	void *base;
+	size_t size;
+	void *pc[DEPTH];
+} *tab;
+
+static int lock[2];
+static size_t live, interval;
+
+static size_t hash(void *base)
+{
+	return ((uintptr_t)base >> 12) * 2654435761u % SLOTS;
+}
+
+int __malloc_sample(void *base, size_t n, size_t rate, void *ra, void *frame)
+{
+	struct sample *s;
+	sigset_t set;
+	uintptr_t top, *fp = frame, *next;
+	size_t i;
+	int d = 0, ret = 0;
+
+	__block_all_sigs(&set);
+	LOCK(lock);
+	if (!tab) {
+		tab = __mmap(0, SLOTS * sizeof *tab, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (tab == MAP_FAILED) tab = 0;
+	}
+	if (!tab || live >= SLOTS/2) goto out;
+
+	for (i=hash(base); tab[i].base; i=(i+1)%SLOTS);
+	s = tab+i;
+	s->base = base;
+	s->size = n;
+	s->pc[d++] = ra;
+
+	/* Past the immediate caller, follow the frame pointer chain as
+	 * far as it stays monotonic within this thread's stack. Callers
+	 * built without frame pointers simply end the walk early. */
+#if defined(__i386__) || defined(__x86_64__)
+	top = libc.threaded && __pthread_self()->stack
+		? (uintptr_t)__pthread_self()->stack : (uintptr_t)libc.auxv;
+	for (; d<DEPTH; d++, fp=next) {
+		next = (void *)*fp;
+		if (next <= fp || (uintptr_t)(next+2) > top
+		 || (uintptr_t)next % sizeof *next || !next[1]) break;
+		s->pc[d] = (void *)next[1];
+	}
+#endif
+	for (; d<DEPTH; d++) s->pc[d] = 0;
+
+	live++;
+	interval = rate;
+	ret = 1;
+out:
+	UNLOCK(lock);
+	__restore_sigs(&set);
+	return ret;
+}
+
+void __malloc_unsample(void *base)
+{
+	sigset_t set;
+	size_t i, j, k;
+
+	__block_all_sigs(&set);
+	LOCK(lock);
+	for (i=hash(base); tab && tab[i].base; i=(i+1)%SLOTS) {
+		if (tab[i].base != base) continue;
+		/* Close the gap so later probes still find their entries */
+		for (j=i; tab[j=(j+1)%SLOTS].base; ) {
+			k = hash(tab[j].base);
+			if (i<=j ? i<k && k<=j : i<k || k<=j) continue;
+			tab[i] = tab[j];
+			i = j;
+		}
+		tab[i].base = 0;
+		live--;
+		break;
+	}
+	UNLOCK(lock);
+	__restore_sigs(&set);
+}
+
+static int put(int fd, const char *s, size_t n)
+{
+	ssize_t r;
+	for (; n; s+=r, n-=r) {
+		r = __syscall(SYS_write, fd, s, n);
+		if (r == -EINTR) r = 0;
+		else if (r < 0) return r;
+	}
+	return 0;
+}
+
+/* Writes the live samples in the legacy text heap profile format read
+ * by pprof, followed by the process's memory map for symbolization. */
+int malloc_dump_profile(int fd)
+{
+	char buf[64 + 19*DEPTH];
+	sigset_t set;
+	size_t i, bytes = 0;
+	int d, l, r, maps;
+
+	__block_all_sigs(&set);
+	LOCK(lock);
+	for (i=0; tab && i<SLOTS; i++)
+		if (tab[i].base) bytes += tab[i].size;
+	l = snprintf(buf, sizeof buf,
+		"heap profile: %zu: %zu [ %zu: %zu] @ heap_v2/%zu\n",
+		live, bytes, live, bytes, interval);
+	r = put(fd, buf, l);
+	for (i=0; !r && tab && i<SLOTS; i++) {
+		if (!tab[i].base) continue;
+		l = snprintf(buf, sizeof buf, "1: %zu [ 1: %zu] @",
+			tab[i].size, tab[i].size);
+		for (d=0; d<DEPTH && tab[i].pc[d]; d++)
+			l += snprintf(buf+l, sizeof buf - l, " %p", tab[i].pc[d]);
+		buf[l++] = '\n';
+		r = put(fd, buf, l);
+	}
+	UNLOCK(lock);
+
+	if (!r) r = put(fd, "\nMAPPED_LIBRARIES:\n", 19);
+	maps = __syscall(SYS_open, "/proc/self/maps", O_RDONLY|O_CLOEXEC);
+	while (!r && maps >= 0 && (l = __syscall(SYS_read, maps, buf, sizeof buf)) > 0)
+		r = put(fd, buf, l);
+	if (maps >= 0) __syscall(SYS_close, maps);
+	__restore_sigs(&set);
+
+	if (r < 0) {
+		errno = -r;
+		return -1;
+	}
+	return 0;
+}
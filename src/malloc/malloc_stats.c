@@ -0,0 +1,51 @@
+#include <malloc.h>
+#include <stdio.h>
+#include "malloc_impl.h"
+
+void malloc_stats(void)
+{
+	struct malloc_stats st;
+	size_t sys = 0, used = 0;
+	int i;
+
+	__malloc_stats(&st);
+	for (i=0; i<MAX_ARENAS+MAX_NODES; i++) {
+		if (!st.arena[i].system) continue;
+		if (i < MAX_ARENAS) fprintf(stderr, "Arena %d:\n", i);
+		else fprintf(stderr, "Node %d arena:\n", i-MAX_ARENAS);
+		fprintf(stderr, "system bytes     = %10zu\n"
+			"in use bytes     = %10zu\n"
+			"free chunks      = %10zu\n"
+			"remote frees     = %10zu\n",
+			st.arena[i].system,
+			st.arena[i].system - st.arena[i].free_bytes
+				- st.arena[i].remote_bytes,
+			st.arena[i].free_chunks,
+			st.arena[i].remote_bytes);
+		sys += st.arena[i].system;
+		used += st.arena[i].system - st.arena[i].free_bytes
+			- st.arena[i].remote_bytes;
+	}
+	for (i=0; i<64; i++) {
+		if (!st.bin[i].chunks) continue;
+		fprintf(stderr, "bin %2d: %zu chunks, %zu bytes\n",
+			i, st.bin[i].chunks, st.bin[i].bytes);
+	}
+	for (i=0; i<SLAB_CLASSES; i++) {
+		if (!st.slab[i].slabs) continue;
+		fprintf(stderr, "slab %3zu: %zu slabs, %zu/%zu objects in use\n",
+			st.slab[i].size, st.slab[i].slabs,
+			st.slab[i].inuse, st.slab[i].objs);
+		sys += st.slab[i].slabs * SLAB_SIZE;
+		used += st.slab[i].slabs * SLAB_SIZE
+			- (st.slab[i].objs - st.slab[i].inuse) * st.slab[i].size;
+	}
+	fprintf(stderr, "Total (incl. mmap):\n"
+		"system bytes     = %10zu\n"
+		"in use bytes     = %10zu\n"
+		"mmap regions     = %10zu\n"
+		"mmap bytes       = %10zu\n"
+		"lock contention  = %10zu\n",
+		sys + st.mmap_bytes, used + st.mmap_bytes,
+		st.mmap_chunks, st.mmap_bytes, st.contended);
+}
@@ -10,6 +10,12 @@ static void dummy(int x)
 
 weak_alias(dummy, __fork_handler);
 
+static void dummy_0()
+{
+}
+
+weak_alias(dummy_0, __stack_cache_fork);
+
 pid_t fork(void)
 {
 	pid_t ret;
@@ -23,6 +29,7 @@ pid_t fork(void)
 		memset(&self->robust_list, 0, sizeof self->robust_list);
 		libc.threads_minus_1 = 0;
 		libc.main_thread = self;
+		__stack_cache_fork();
 	}
 	__restore_sigs(&set);
 	__fork_handler(!ret);
@@ -4,14 +4,32 @@
 #include "futex.h"
 #include "syscall.h"
 
+static int no_bitset;
+
 static int do_wait(volatile int *addr, int val,
 	clockid_t clk, const struct timespec *at, int priv)
 {
-	int r;
+	int r, op;
 	struct timespec to, *top=0;
 
+	if (priv) priv = FUTEX_PRIVATE;
+
 	if (at) {
 		if (at->tv_nsec >= 1000000000UL) return EINVAL;
+		if (at->tv_sec < 0) return ETIMEDOUT;
+		/* Pass deadlines on clocks the kernel knows as they are,
+		 * saving a clock read per wait and the drift of converting
+		 * them; kernels before 2.6.28 lack this and get the
+		 * relative timeout instead. */
+		if ((clk == CLOCK_REALTIME || clk == CLOCK_MONOTONIC) && !no_bitset) {
+			op = FUTEX_WAIT_BITSET | priv;
+			if (clk == CLOCK_REALTIME) op |= FUTEX_CLOCK_REALTIME;
+			r = -__syscall_cp(SYS_futex, addr, op, val, at, 0, -1);
+			if (r == ENOSYS && priv)
+				r = -__syscall_cp(SYS_futex, addr, op & ~priv, val, at, 0, -1);
+			if (r != ENOSYS) goto done;
+			no_bitset = 1;
+		}
 		if (clock_gettime(clk, &to)) return EINVAL;
 		to.tv_sec = at->tv_sec - to.tv_sec;
 		if ((to.tv_nsec = at->tv_nsec - to.tv_nsec) < 0) {
@@ -22,7 +40,10 @@ static int do_wait(volatile int *addr, int val,
 		top = &to;
 	}
 
-	r = -__syscall_cp(SYS_futex, addr, FUTEX_WAIT, val, top);
+	r = -__syscall_cp(SYS_futex, addr, FUTEX_WAIT|priv, val, top);
+	if (r == ENOSYS && priv)
+		r = -__syscall_cp(SYS_futex, addr, FUTEX_WAIT, val, top);
+done:
 	if (r == EINTR || r == EINVAL || r == ETIMEDOUT) return r;
 	return 0;
 }
@@ -1,15 +1,32 @@
 #include "pthread_impl.h"
 
+#define SPIN_MAX 10000
+
+/* Spins while *addr is val, for up to about twice the spins recent
+ * waits on the same lock needed, as tracked in *est. Waits that end
+ * in time pull the estimate toward their length and ones that run out
+ * push it up, but nothing is spent once waiters are already asleep:
+ * the lock will be handed to them, so spinning only burns CPU the
+ * owner may need. Returns nonzero if *addr changed. */
+int __spin(volatile int *addr, int val, volatile int *waiters, volatile int *est)
+{
+	int n = *est, lim = n < SPIN_MAX/2 ? 2*n+10 : SPIN_MAX, i;
+	for (i=0; i<lim && *addr==val; i++) {
+		if (waiters && *waiters) return 0;
+		a_spin();
+	}
+	*est = n + (i-n)/8;
+	return i < lim;
+}
+
 void __wait(volatile int *addr, volatile int *waiters, int val, int priv)
 {
-	int spins=10000;
-	if (priv) priv = 128; priv=0;
+	int spins=SPIN_MAX;
 	while (spins--) {
 		if (*addr==val) a_spin();
 		else return;
 	}
 	if (waiters) a_inc(waiters);
-	while (*addr==val)
-		__syscall(SYS_futex, (long)addr, FUTEX_WAIT|priv, val, 0);
+	while (*addr==val) __futexwait(addr, val, priv);
 	if (waiters) a_dec(waiters);
 }
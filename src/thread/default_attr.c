@@ -0,0 +1,38 @@
+#include <elf.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "pthread_impl.h"
+#include "libc.h"
+
+#if ULONG_MAX == 0xffffffff
+typedef Elf32_Phdr Phdr;
+#else
+typedef Elf64_Phdr Phdr;
+#endif
+
+/* Stack and guard sizes given to threads created without attributes
+ * and to newly initialized attributes, in the same encoding as the
+ * fields of pthread_attr_t. */
+pthread_attr_t __default_attr;
+
+/* The executable can ask for a default stack size with PT_GNU_STACK,
+ * as set by ld -z stack-size, and the environment can override it
+ * unless the program is running with elevated privileges. */
+void __init_default_attr(size_t *aux)
+{
+	unsigned char *p;
+	size_t n;
+	Phdr *phdr;
+	char *e;
+
+	for (p=(void *)aux[AT_PHDR],n=aux[AT_PHNUM]; n; n--,p+=aux[AT_PHENT]) {
+		phdr = (void *)p;
+		if (phdr->p_type == PT_GNU_STACK && phdr->p_memsz)
+			pthread_attr_setstacksize(&__default_attr, phdr->p_memsz);
+	}
+	if (libc.secure) return;
+	if ((e = getenv("PTHREAD_STACK_SIZE")))
+		pthread_attr_setstacksize(&__default_attr, atol(e));
+	if ((e = getenv("PTHREAD_GUARD_SIZE")))
+		pthread_attr_setguardsize(&__default_attr, atol(e));
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "pthread_impl.h"
 
 int pthread_attr_getdetachstate(const pthread_attr_t *a, int *state)
@@ -52,7 +53,13 @@ int pthread_attr_getstacksize(const pthread_attr_t *restrict a, size_t *restrict
 
 int pthread_barrierattr_getpshared(const pthread_barrierattr_t *restrict a, int *restrict pshared)
 {
-	*pshared = !!a->__attr;
+	*pshared = a->__attr>>31;
+	return 0;
+}
+
+int pthread_barrierattr_getkind_np(const pthread_barrierattr_t *restrict a, int *restrict kind)
+{
+	*kind = !!(a->__attr & BARRIER_TREE);
 	return 0;
 }
 
@@ -70,7 +77,7 @@ int pthread_condattr_getpshared(const pthread_condattr_t *restrict a, int *restr
 
 int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *restrict a, int *restrict protocol)
 {
-	*protocol = PTHREAD_PRIO_NONE;
+	*protocol = a->__attr & 8 ? PTHREAD_PRIO_INHERIT : PTHREAD_PRIO_NONE;
 	return 0;
 }
 int pthread_mutexattr_getpshared(const pthread_mutexattr_t *restrict a, int *restrict pshared)
@@ -96,3 +103,9 @@ int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *restrict a, int *r
 	*pshared = a->__attr[0];
 	return 0;
 }
+
+int pthread_rwlockattr_getkind_np(const pthread_rwlockattr_t *restrict a, int *restrict kind)
+{
+	*kind = a->__attr[1];
+	return 0;
+}
@@ -2,6 +2,6 @@
 
 int pthread_attr_init(pthread_attr_t *a)
 {
-	*a = (pthread_attr_t){0};
+	*a = __default_attr;
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include "pthread_impl.h"
+#include <stdlib.h>
 
 void __vm_lock(int), __vm_unlock(void);
 
@@ -13,6 +14,14 @@ int pthread_barrier_destroy(pthread_barrier_t *b)
 		}
 		__vm_lock(-1);
 		__vm_unlock();
+	} else if (b->_b_limit & BARRIER_TREE) {
+		int v;
+		/* Threads released by the last wait may still be on
+		 * their way out of the nodes. */
+		a_or(&b->_b_lock, INT_MIN);
+		while ((v = b->_b_lock) & INT_MAX)
+			__wait(&b->_b_lock, 0, v, 1);
+		free(b->_b_nodes);
 	}
 	return 0;
 }
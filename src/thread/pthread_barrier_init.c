@@ -1,8 +1,35 @@
 #include "pthread_impl.h"
+#include <stdlib.h>
+
+/* Lays out the combining tree level by level, leaves first: each
+ * level groups the units below it (threads, then nodes) by fanout,
+ * and the root comes last. */
+static struct barrier_node *tree(unsigned n)
+{
+	struct barrier_node *t;
+	unsigned total = 0, c, m, o, i;
+
+	for (c=n; c>1; c=m) total += m = (c+BARRIER_FANOUT-1)/BARRIER_FANOUT;
+	if (!(t = calloc(total, sizeof *t))) return 0;
+	for (o=0, c=n; c>1; o+=m, c=m) {
+		m = (c+BARRIER_FANOUT-1)/BARRIER_FANOUT;
+		for (i=0; i<m; i++) {
+			t[o+i].cap = i<m-1 ? BARRIER_FANOUT : c-BARRIER_FANOUT*(m-1);
+			t[o+i].parent = o+m + i/BARRIER_FANOUT;
+		}
+	}
+	t[total-1].parent = -1;
+	return t;
+}
 
 int pthread_barrier_init(pthread_barrier_t *restrict b, const pthread_barrierattr_t *restrict a, unsigned count)
 {
+	unsigned attr = a ? a->__attr : 0;
 	if (count-1 > INT_MAX-1) return EINVAL;
-	*b = (pthread_barrier_t){ ._b_limit = count-1 | (a?a->__attr:0) };
+	/* Tree nodes live in this process's heap */
+	if (attr>>31 || count<2) attr &= ~BARRIER_TREE;
+	if (attr & BARRIER_TREE && count-1 >= BARRIER_TREE) return EINVAL;
+	*b = (pthread_barrier_t){ ._b_limit = count-1 | attr };
+	if (attr & BARRIER_TREE && !(b->_b_nodes = tree(count))) return ENOMEM;
 	return 0;
 }
@@ -52,6 +52,55 @@ static int pshared_barrier_wait(pthread_barrier_t *b)
 	return ret;
 }
 
+static int tree_barrier_wait(pthread_barrier_t *b)
+{
+	struct barrier_node *t = b->_b_nodes, *x, *done[32];
+	int n = (b->_b_limit & (BARRIER_TREE-1)) + 1;
+	int leaves = (n+BARRIER_FANOUT-1)/BARRIER_FANOUT;
+	int i = pthread_self()->tid % leaves;
+	int d = 0, w, v, ret;
+
+	/* _b_lock counts the threads inside, for destroy to wait on */
+	a_inc(&b->_b_lock);
+
+	/* Join the first leaf, from this thread's own on, with room */
+	for (;;) {
+		x = t+i;
+		w = x->word;
+		if ((w & 0xffff) == x->cap) {
+			i = (i+1) % leaves;
+			a_spin();
+		} else if (a_cas(&x->word, w, w+1) == w) break;
+	}
+
+	/* The last arrival at each node goes on to its parent, and the
+	 * one completing the root is released first. */
+	while ((w & 0xffff)+1 == x->cap) {
+		done[d++] = x;
+		if (x->parent < 0) break;
+		x = t + x->parent;
+		w = a_fetch_add(&x->word, 1);
+	}
+	if ((w & 0xffff)+1 != x->cap)
+		while (((v = x->word) ^ w) >> 16 == 0)
+			__wait(&x->word, &x->waiters, v, 1);
+
+	ret = d && done[d-1]->parent < 0 ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+
+	/* Release the completed nodes from the top down */
+	for (i=d-1; i>=0; i--) {
+		x = done[i];
+		a_store(&x->word, ((unsigned)x->word | 0xffff) + 1);
+		if (x->waiters) __wake(&x->word, -1, 1);
+	}
+
+	/* Past here the nodes may be freed */
+	if (a_fetch_add(&b->_b_lock, -1) == INT_MIN+1)
+		__wake(&b->_b_lock, 1, 1);
+
+	return ret;
+}
+
 struct instance
 {
 	int count;
@@ -71,6 +120,8 @@ int pthread_barrier_wait(pthread_barrier_t *b)
 	/* Process-shared barriers require a separate, inefficient wait */
 	if (limit < 0) return pshared_barrier_wait(b);
 
+	if (limit & BARRIER_TREE) return tree_barrier_wait(b);
+
 	/* Otherwise we need a lock on the barrier object */
 	while (a_swap(&b->_b_lock, 1))
 		__wait(&b->_b_lock, &b->_b_waiters, 1, 1);
@@ -87,7 +138,7 @@ int pthread_barrier_wait(pthread_barrier_t *b)
 			a_spin();
 		a_inc(&inst->finished);
 		while (inst->finished == 1)
-			__syscall(SYS_futex, &inst->finished, FUTEX_WAIT,1,0);
+			__futexwait(&inst->finished, 1, 1);
 		return PTHREAD_BARRIER_SERIAL_THREAD;
 	}
 
@@ -0,0 +1,9 @@
+#define _GNU_SOURCE
+#include "pthread_impl.h"
+
+int pthread_barrierattr_setkind_np(pthread_barrierattr_t *a, int kind)
+{
+	if (kind > 1U) return EINVAL;
+	a->__attr = (a->__attr & ~BARRIER_TREE) | (kind ? BARRIER_TREE : 0);
+	return 0;
+}
@@ -2,12 +2,13 @@
 
 int pthread_cond_destroy(pthread_cond_t *c)
 {
-	int priv = c->_c_mutex != (void *)-1;
 	int cnt;
+	/* Private waiters never touch the cv once signaled */
+	if (!c->_c_shared) return 0;
 	c->_c_destroy = 1;
 	if (c->_c_waiters)
-		__wake(&c->_c_seq, -1, priv);
+		__wake(&c->_c_seq, -1, 0);
 	while ((cnt = c->_c_waiters))
-		__wait(&c->_c_waiters, 0, cnt, priv);
+		__wait(&c->_c_waiters, 0, cnt, 0);
 	return 0;
 }
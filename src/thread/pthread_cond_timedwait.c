@@ -1,47 +1,113 @@
 #include "pthread_impl.h"
 
-struct cm {
+/* Each waiter on a private cv queues a node in its own automatic
+ * storage, newest at _c_head, and sleeps on the node's own barrier
+ * futex. Signal and broadcast detach the oldest waiters from the list
+ * and release only the first of them; each woken waiter, once it has
+ * the mutex, requeues the next onto the mutex futex rather than
+ * waking it, so a broadcast wakes no more threads than can make
+ * progress. The cv lock is only held to splice the list.
+ *
+ * Process-shared cvs cannot see other processes' nodes, so they keep
+ * waiting on _c_seq and only use the node to reach the cleanup. */
+
+struct waiter {
+	struct waiter *prev, *next;
+	volatile int state, barrier;
+	volatile int *notify;
+	int shared;
 	pthread_cond_t *c;
 	pthread_mutex_t *m;
 };
 
-static void unwait(pthread_cond_t *c, pthread_mutex_t *m)
+enum {
+	WAITING,
+	SIGNALED,
+	LEAVING,
+};
+
+/* These lock and unlock functions are safe against the memory being
+ * freed as soon as the lock is released. */
+
+static void lock(volatile int *l)
+{
+	if (a_cas(l, 0, 1)) {
+		a_cas(l, 1, 2);
+		do __wait(l, 0, 2, 1);
+		while (a_cas(l, 0, 2));
+	}
+}
+
+static void unlock(volatile int *l)
+{
+	if (a_swap(l, 0)==2)
+		__wake(l, 1, 1);
+}
+
+static void unlock_requeue(volatile int *l, volatile int *r, int w)
+{
+	a_store(l, 0);
+	if (w) __wake(l, 1, 1);
+	else __syscall(SYS_futex, l, FUTEX_REQUEUE|FUTEX_PRIVATE, 0, 1, r) != -ENOSYS
+		|| __syscall(SYS_futex, l, FUTEX_REQUEUE, 0, 1, r);
+}
+
+static int leave(struct waiter *node)
 {
-	/* Removing a waiter is non-trivial if we could be using requeue
-	 * based broadcast signals, due to mutex access issues, etc. */
+	pthread_cond_t *c = node->c;
+	pthread_mutex_t *m = node->m;
+	int oldstate = WAITING, r;
 
-	if (c->_c_mutex == (void *)-1) {
+	if (node->shared) {
 		a_dec(&c->_c_waiters);
 		if (c->_c_destroy) __wake(&c->_c_waiters, 1, 0);
-		return;
+	} else if ((oldstate = a_cas(&node->state, WAITING, LEAVING)) == WAITING) {
+		/* Not yet signaled, so the cv is still valid; a signaler
+		 * that sees this node LEAVING waits on notify for it to
+		 * be unlinked before proceeding. */
+		lock(&c->_c_lock);
+		if (c->_c_head == node) c->_c_head = node->next;
+		else if (node->prev) node->prev->next = node->next;
+		if (c->_c_tail == node) c->_c_tail = node->prev;
+		else if (node->next) node->next->prev = node->prev;
+		unlock(&c->_c_lock);
+
+		if (node->notify && a_fetch_add(node->notify, -1)==1)
+			__wake(node->notify, 1, 1);
+	} else {
+		/* Taking the barrier waits for earlier signaled waiters */
+		lock(&node->barrier);
 	}
 
-	while (a_swap(&c->_c_lock, 1))
-		__wait(&c->_c_lock, &c->_c_lockwait, 1, 1);
+	r = pthread_mutex_lock(m);
 
-	if (c->_c_waiters2) c->_c_waiters2--;
-	else a_dec(&m->_m_waiters);
+	if (oldstate == WAITING) return r;
 
-	a_store(&c->_c_lock, 0);
-	if (c->_c_lockwait) __wake(&c->_c_lock, 1, 1);
+	/* The first waiter of the detached group stands in for the
+	 * rest on the mutex waiter count, so unlock keeps waking. */
+	if (!node->next) a_inc(&m->_m_waiters);
 
-	a_dec(&c->_c_waiters);
-	if (c->_c_destroy) __wake(&c->_c_waiters, 1, 1);
+	/* Shared and PI mutex futexes cannot take requeued waiters */
+	if (node->prev)
+		unlock_requeue(&node->prev->barrier, &m->_m_lock, m->_m_type & (128|16));
+	else
+		a_dec(&m->_m_waiters);
+
+	return r;
 }
 
 static void cleanup(void *p)
 {
-	struct cm *cm = p;
-	unwait(cm->c, cm->m);
-	pthread_mutex_lock(cm->m);
+	leave(p);
 }
 
 int pthread_cond_timedwait(pthread_cond_t *restrict c, pthread_mutex_t *restrict m, const struct timespec *restrict ts)
 {
-	struct cm cm = { .c=c, .m=m };
-	int r, e=0, seq;
+	struct waiter node = { .c = c, .m = m, .shared = !!c->_c_shared };
+	int r, e=0, seq, clock = c->_c_clock, priv = !node.shared;
+	volatile int *fut;
 
-	if (m->_m_type && (m->_m_lock&INT_MAX) != pthread_self()->tid)
+	if ((m->_m_type&31) && (m->_m_lock&INT_MAX) != pthread_self()->tid)
 		return EPERM;
 
 	if (ts && ts->tv_nsec >= 1000000000UL)
@@ -49,28 +115,63 @@ int pthread_cond_timedwait(pthread_cond_t *restrict c, pthread_mutex_t *restrict
 
 	pthread_testcancel();
 
-	a_inc(&c->_c_waiters);
-
-	if (c->_c_mutex != (void *)-1) {
-		c->_c_mutex = m;
-		while (a_swap(&c->_c_lock, 1))
-			__wait(&c->_c_lock, &c->_c_lockwait, 1, 1);
-		c->_c_waiters2++;
-		a_store(&c->_c_lock, 0);
-		if (c->_c_lockwait) __wake(&c->_c_lock, 1, 1);
+	if (!priv) {
+		fut = &c->_c_seq;
+		seq = c->_c_seq;
+		a_inc(&c->_c_waiters);
+	} else {
+		lock(&c->_c_lock);
+		seq = node.barrier = 2;
+		fut = &node.barrier;
+		node.next = c->_c_head;
+		c->_c_head = &node;
+		if (!c->_c_tail) c->_c_tail = &node;
+		else node.next->prev = &node;
+		unlock(&c->_c_lock);
 	}
 
-	seq = c->_c_seq;
-
 	pthread_mutex_unlock(m);
 
-	do e = __timedwait(&c->_c_seq, seq, c->_c_clock, ts, cleanup, &cm, 0);
-	while (c->_c_seq == seq && (!e || e==EINTR));
+	do e = __timedwait(fut, seq, clock, ts, cleanup, &node, priv);
+	while (*fut == seq && (!e || e==EINTR));
 	if (e == EINTR) e = 0;
 
-	unwait(c, m);
-
-	if ((r=pthread_mutex_lock(m))) return r;
+	if ((r = leave(&node))) return r;
 
 	return e;
 }
+
+int __private_cond_signal(pthread_cond_t *c, int n)
+{
+	struct waiter *p, *first=0;
+	volatile int ref = 0;
+	int cur;
+
+	lock(&c->_c_lock);
+	for (p=c->_c_tail; n && p; p=p->prev) {
+		if (a_cas(&p->state, WAITING, SIGNALED) != WAITING) {
+			ref++;
+			p->notify = &ref;
+		} else {
+			n--;
+			if (!first) first=p;
+		}
+	}
+	/* Split the list, leaving any remainder on the cv. */
+	if (p) {
+		if (p->next) p->next->prev = 0;
+		p->next = 0;
+	} else {
+		c->_c_head = 0;
+	}
+	c->_c_tail = p;
+	unlock(&c->_c_lock);
+
+	/* Waiters seen LEAVING must be off the list before the
+	 * signaled ones may run or the caller may destroy the cv. */
+	while ((cur = ref)) __wait(&ref, 0, cur, 1);
+
+	if (first) unlock(&first->barrier);
+
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include "stdio_impl.h"
 #include "libc.h"
 #include <sys/mman.h>
+#include <string.h>
 
 static void dummy_0()
 {
@@ -10,11 +11,13 @@ static void dummy_0()
 weak_alias(dummy_0, __acquire_ptc);
 weak_alias(dummy_0, __release_ptc);
 weak_alias(dummy_0, __pthread_tsd_run_dtors);
+weak_alias(dummy_0, __malloc_tls_flush);
 
 _Noreturn void pthread_exit(void *result)
 {
 	pthread_t self = pthread_self();
 	sigset_t set;
+	int cached = 0;
 
 	self->result = result;
 
@@ -26,9 +29,18 @@ _Noreturn void pthread_exit(void *result)
 	}
 
 	__pthread_tsd_run_dtors();
+	__malloc_tls_flush();
 
 	__lock(self->exitlock);
 
+	/* A detached thread's mapping can be handed to the stack cache
+	 * while still in use, since it is only reused once the kernel
+	 * has cleared the tid. This must happen before the thread count
+	 * drops: once the remaining threads may see the process as
+	 * single-threaded, __lock no longer excludes this one. */
+	if (self->detached && self->map_base)
+		cached = __stack_cache_put(self);
+
 	/* Mark this thread dead before decrementing count */
 	__lock(self->killlock);
 	self->dead = 1;
@@ -57,15 +69,12 @@ _Noreturn void pthread_exit(void *result)
 		exit(0);
 	}
 
-	if (self->detached && self->map_base) {
+	if (self->detached && self->map_base && !cached) {
 		/* Detached threads must avoid the kernel clear_child_tid
 		 * feature, since the virtual address will have been
 		 * unmapped and possibly already reused by a new mapping
-		 * at the time the kernel would perform the write. In
-		 * the case of threads that started out detached, the
-		 * initial clone flags are correct, but if the thread was
-		 * detached later (== 2), we need to clear it here. */
-		if (self->detached == 2) __syscall(SYS_set_tid_address, 0);
+		 * at the time the kernel would perform the write. */
+		__syscall(SYS_set_tid_address, 0);
 
 		/* The following call unmaps the thread's stack mapping
 		 * and then exits without touching the stack. */
@@ -123,17 +132,82 @@ static void init_file_lock(FILE *f)
 
 void *__copy_tls(unsigned char *);
 
+#define STACK_CACHE 16
+
+/* Stack, guard and TLS mappings of exited threads, reused by
+ * pthread_create for threads of the same size and guard size once
+ * the kernel has cleared the old thread's tid. */
+static struct {
+	unsigned char *map;
+	size_t size, guard;
+	volatile int *tid;
+} cache[STACK_CACHE];
+static int cache_lock[2];
+
+int __stack_cache_put(struct pthread *t)
+{
+	int i, j = -1;
+
+	LOCK(cache_lock);
+	for (i=0; i<STACK_CACHE; i++) {
+		if (!cache[i].map) break;
+		if (j < 0 && !*cache[i].tid) j = i;
+	}
+	/* When full, make room by dropping a mapping no longer in use */
+	if (i == STACK_CACHE && j >= 0) {
+		munmap(cache[j].map, cache[j].size);
+		i = j;
+	}
+	if (i < STACK_CACHE) {
+		cache[i].map = t->map_base;
+		cache[i].size = t->map_size;
+		cache[i].guard = t->guard_size;
+		cache[i].tid = &t->tid;
+	}
+	UNLOCK(cache_lock);
+	return i < STACK_CACHE;
+}
+
+/* The child of fork has none of the threads that owned the cached
+ * mappings, and no kernel will clear their tids there. Nor will a
+ * thread that held the cache lock at fork release it. */
+void __stack_cache_fork()
+{
+	int i;
+	cache_lock[0] = cache_lock[1] = 0;
+	for (i=0; i<STACK_CACHE; i++)
+		if (cache[i].map) *cache[i].tid = 0;
+}
+
+static unsigned char *cache_get(size_t size, size_t guard)
+{
+	unsigned char *map = 0;
+	int i;
+
+	LOCK(cache_lock);
+	for (i=0; i<STACK_CACHE; i++) {
+		if (cache[i].map && cache[i].size == size
+		 && cache[i].guard == guard && !*cache[i].tid) {
+			map = cache[i].map;
+			cache[i].map = 0;
+			break;
+		}
+	}
+	UNLOCK(cache_lock);
+	return map;
+}
+
 int pthread_create(pthread_t *restrict res, const pthread_attr_t *restrict attrp, void *(*entry)(void *), void *restrict arg)
 {
 	int ret;
-	size_t size, guard;
+	size_t size, guard = 0;
 	struct pthread *self = pthread_self(), *new;
 	unsigned char *map = 0, *stack = 0, *tsd = 0, *stack_limit;
 	unsigned flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND
 		| CLONE_THREAD | CLONE_SYSVSEM | CLONE_SETTLS
 		| CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID | CLONE_DETACHED;
 	int do_sched = 0;
-	pthread_attr_t attr = {0};
+	pthread_attr_t attr;
 
 	if (!self) return ENOSYS;
 	if (!libc.threaded) {
@@ -144,10 +218,12 @@ int pthread_create(pthread_t *restrict res, const pthread_attr_t *restrict attrp
 		init_file_lock(__stderr_used);
 		libc.threaded = 1;
 	}
-	if (attrp) attr = *attrp;
 
 	__acquire_ptc();
 
+	if (attrp) attr = *attrp;
+	else attr = __default_attr;
+
 	if (attr._a_stackaddr) {
 		size_t need = libc.tls_size + __pthread_tsd_size;
 		size = attr._a_stacksize + DEFAULT_STACK_SIZE;
@@ -170,7 +246,11 @@ int pthread_create(pthread_t *restrict res, const pthread_attr_t *restrict attrp
 	}
 
 	if (!tsd) {
-		if (guard) {
+		if ((map = cache_get(size, guard))) {
+			/* Start from the zeroed TLS and TSD of a new mapping */
+			memset(map + size - __pthread_tsd_size - libc.tls_size,
+				0, libc.tls_size + __pthread_tsd_size);
+		} else if (guard) {
 			map = mmap(0, size, PROT_NONE, MAP_PRIVATE|MAP_ANON, -1, 0);
 			if (map == MAP_FAILED) goto fail;
 			if (mprotect(map+guard, size-guard, PROT_READ|PROT_WRITE)) {
@@ -191,6 +271,7 @@ int pthread_create(pthread_t *restrict res, const pthread_attr_t *restrict attrp
 	new = __copy_tls(tsd - libc.tls_size);
 	new->map_base = map;
 	new->map_size = size;
+	new->guard_size = guard;
 	new->stack = stack;
 	new->stack_size = stack - stack_limit;
 	new->pid = self->pid;
@@ -201,7 +282,8 @@ int pthread_create(pthread_t *restrict res, const pthread_attr_t *restrict attrp
 	new->tsd = (void *)tsd;
 	if (attr._a_detach) {
 		new->detached = 1;
-		flags -= CLONE_CHILD_CLEARTID;
+		/* Keep the tid cleared on exit if the mapping may be cached */
+		if (!map) flags -= CLONE_CHILD_CLEARTID;
 	}
 	if (attr._a_sched) {
 		do_sched = new->startlock[0] = 1;
@@ -5,44 +5,60 @@ void *__pthread_tsd_main[PTHREAD_KEYS_MAX] = { 0 };
 
 static void (*keys[PTHREAD_KEYS_MAX])(void *);
 
+/* Bitmap of allocated keys; each thread keeps a matching bitmap of
+ * the keys it has set, so neither creation nor exit has to look at
+ * every slot. */
+static volatile int used[PTHREAD_KEYS_MAX/32];
+
 static void nodtor(void *dummy)
 {
 }
 
 int pthread_key_create(pthread_key_t *k, void (*dtor)(void *))
 {
-	unsigned i = (uintptr_t)&k / 16 % PTHREAD_KEYS_MAX;
-	unsigned j = i;
+	unsigned i, w;
 
 	__pthread_self_init();
 	if (!dtor) dtor = nodtor;
-	do {
-		if (!a_cas_p(keys+j, 0, (void *)dtor)) {
-			*k = j;
+	for (i=0; i<PTHREAD_KEYS_MAX/32; i++) {
+		while (~(w = used[i])) {
+			int b = a_ctz_l(~w);
+			if (a_cas(used+i, w, w | 1U<<b) != w) continue;
+			*k = 32*i + b;
+			keys[*k] = dtor;
 			return 0;
 		}
-	} while ((j=(j+1)%PTHREAD_KEYS_MAX) != i);
+	}
 	return EAGAIN;
 }
 
 int pthread_key_delete(pthread_key_t k)
 {
 	keys[k] = 0;
+	a_and(used+k/32, ~(1U<<k%32));
 	return 0;
 }
 
 void __pthread_tsd_run_dtors()
 {
 	pthread_t self = __pthread_self();
-	int i, j, not_finished = self->tsd_used;
+	int i, j, b, not_finished = 1;
+	unsigned w;
 	for (j=0; not_finished && j<PTHREAD_DESTRUCTOR_ITERATIONS; j++) {
 		not_finished = 0;
-		for (i=0; i<PTHREAD_KEYS_MAX; i++) {
-			if (self->tsd[i] && keys[i]) {
-				void *tmp = self->tsd[i];
-				self->tsd[i] = 0;
-				keys[i](tmp);
-				not_finished = 1;
+		for (i=0; i<PTHREAD_KEYS_MAX/32; i++) {
+			/* Destructors may set keys again; those bits are
+			 * picked up on the next pass. */
+			w = self->tsd_used[i];
+			self->tsd_used[i] = 0;
+			for (; w; w &= w-1) {
+				b = 32*i + a_ctz_l(w);
+				if (self->tsd[b] && keys[b]) {
+					void *tmp = self->tsd[b];
+					self->tsd[b] = 0;
+					keys[b](tmp);
+					not_finished = 1;
+				}
 			}
 		}
 	}
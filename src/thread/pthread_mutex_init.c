@@ -3,6 +3,8 @@
 int pthread_mutex_init(pthread_mutex_t *restrict m, const pthread_mutexattr_t *restrict a)
 {
 	*m = (pthread_mutex_t){0};
-	if (a) m->_m_type = a->__attr & 7;
+	if (a) m->_m_type = a->__attr & 7 | (a->__attr & 8)*2;
+	/* The kernel wakes robust mutexes of dead owners as shared */
+	if (a && (a->__attr>>31 || a->__attr & 4)) m->_m_type |= 128;
 	return 0;
 }
@@ -1,22 +1,58 @@
+#define _GNU_SOURCE
 #include "pthread_impl.h"
 
+/* The kernel queues waiters on PI mutexes by priority and lends the
+ * owner the top waiter's priority; the deadline is absolute on
+ * CLOCK_REALTIME, as FUTEX_LOCK_PI takes it. */
+static int pi_lock(pthread_mutex_t *restrict m, const struct timespec *restrict at)
+{
+	int priv = m->_m_type & 128 ? 0 : FUTEX_PRIVATE, r;
+
+	if (m->_m_type & 4)
+		pthread_self()->robust_list.pending = &m->_m_next;
+
+	do r = -__syscall(SYS_futex, &m->_m_lock, FUTEX_LOCK_PI|priv, 0, at);
+	while (r == EINTR);
+
+	switch (r) {
+	case 0:
+		return __pthread_mutex_taken(m, m->_m_lock & 0x40000000);
+	case EDEADLK:
+		if ((m->_m_type&3) == PTHREAD_MUTEX_ERRORCHECK) break;
+		/* Other types deadlock on relocking, until the deadline */
+		while (__timedwait(&(int){0}, 0, CLOCK_REALTIME, at, 0, 0, 1)
+			!= ETIMEDOUT);
+		r = ETIMEDOUT;
+	}
+	if (m->_m_type & 4) pthread_self()->robust_list.pending = 0;
+	return r;
+}
+
 int pthread_mutex_timedlock(pthread_mutex_t *restrict m, const struct timespec *restrict at)
 {
-	int r, t;
+	int r, t, priv = !(m->_m_type&128);
 
-	if (m->_m_type == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, EBUSY))
+	if ((m->_m_type&31) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, EBUSY))
 		return 0;
 
 	while ((r=pthread_mutex_trylock(m)) == EBUSY) {
+		if (m->_m_type & 16) return pi_lock(m, at);
+
 		if (!(r=m->_m_lock) || (r&0x40000000)) continue;
 		if ((m->_m_type&3) == PTHREAD_MUTEX_ERRORCHECK
 		 && (r&0x1fffffff) == pthread_self()->tid)
 			return EDEADLK;
 
+		/* Adaptive mutexes are never recursive, so _m_count is free
+		 * to hold the lock's learned spin estimate. */
+		if ((m->_m_type&3) == PTHREAD_MUTEX_ADAPTIVE_NP
+		 && __spin(&m->_m_lock, r, &m->_m_waiters, &m->_m_count))
+			continue;
+
 		a_inc(&m->_m_waiters);
 		t = r | 0x80000000;
 		a_cas(&m->_m_lock, r, t);
-		r = __timedwait(&m->_m_lock, t, CLOCK_REALTIME, at, 0, 0, 0);
+		r = __timedwait(&m->_m_lock, t, CLOCK_REALTIME, at, 0, 0, priv);
 		a_dec(&m->_m_waiters);
 		if (r && r != EINTR) break;
 	}
@@ -5,13 +5,13 @@ int pthread_mutex_trylock(pthread_mutex_t *m)
 	int tid, old, own;
 	pthread_t self;
 
-	if (m->_m_type == PTHREAD_MUTEX_NORMAL)
+	if ((m->_m_type&31) == PTHREAD_MUTEX_NORMAL)
 		return a_cas(&m->_m_lock, 0, EBUSY) & EBUSY;
 
 	self = pthread_self();
 	tid = self->tid;
 
-	if (m->_m_type >= 4) {
+	if (m->_m_type & 4) {
 		if (!self->robust_list.off)
 			__syscall(SYS_set_robust_list,
 				&self->robust_list, 3*sizeof(long));
@@ -27,13 +27,31 @@ int pthread_mutex_trylock(pthread_mutex_t *m)
 		return 0;
 	}
 
-	if ((own && !(own & 0x40000000)) || a_cas(&m->_m_lock, old, tid)!=old)
+	/* A PI lock word with waiters belongs to the kernel, which can
+	 * still hand it over if its owner has died. */
+	if ((m->_m_type & 16) && old < 0) {
+		if (__syscall(SYS_futex, &m->_m_lock, FUTEX_TRYLOCK_PI
+		    | (m->_m_type & 128 ? 0 : FUTEX_PRIVATE))) return EBUSY;
+		own = m->_m_lock & 0x40000000;
+	} else if ((own && !(own & 0x40000000)) || a_cas(&m->_m_lock, old, tid)!=old)
 		return EBUSY;
 
-	if (m->_m_type < 4) return 0;
+	return __pthread_mutex_taken(m, own);
+}
+
+/* Finishes taking a robust mutex once its lock word is claimed: own
+ * is the previous owner field, flagging a dead owner if nonzero. */
+int __pthread_mutex_taken(pthread_mutex_t *m, int own)
+{
+	pthread_t self;
+
+	if (!(m->_m_type & 4)) return 0;
 
-	if (m->_m_type >= 8) {
-		m->_m_lock = 0;
+	self = pthread_self();
+	if (m->_m_type & 8) {
+		if (!(m->_m_type & 16)) m->_m_lock = 0;
+		else if (a_cas(&m->_m_lock, self->tid, 0) != self->tid)
+			__syscall(SYS_futex, &m->_m_lock, FUTEX_UNLOCK_PI);
 		return ENOTRECOVERABLE;
 	}
 	m->_m_next = self->robust_list.head;
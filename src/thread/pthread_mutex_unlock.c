@@ -10,7 +10,7 @@ int pthread_mutex_unlock(pthread_mutex_t *m)
 	int cont;
 	int robust = 0;
 
-	if (m->_m_type != PTHREAD_MUTEX_NORMAL) {
+	if ((m->_m_type&31) != PTHREAD_MUTEX_NORMAL) {
 		if (!m->_m_lock)
 			return EPERM;
 		self = pthread_self();
@@ -18,7 +18,7 @@ int pthread_mutex_unlock(pthread_mutex_t *m)
 			return EPERM;
 		if ((m->_m_type&3) == PTHREAD_MUTEX_RECURSIVE && m->_m_count)
 			return m->_m_count--, 0;
-		if (m->_m_type >= 4) {
+		if (m->_m_type & 4) {
 			robust = 1;
 			self->robust_list.pending = &m->_m_next;
 			*(void **)m->_m_prev = m->_m_next;
@@ -26,12 +26,19 @@ int pthread_mutex_unlock(pthread_mutex_t *m)
 			__vm_lock_impl(+1);
 		}
 	}
-	cont = a_swap(&m->_m_lock, 0);
+	/* Only the kernel may release a PI lock that has waiters */
+	if (m->_m_type & 16) {
+		int tid = __pthread_self()->tid;
+		cont = 0;
+		if (a_cas(&m->_m_lock, tid, 0) != tid)
+			__syscall(SYS_futex, &m->_m_lock, FUTEX_UNLOCK_PI
+				| (m->_m_type & 128 ? 0 : FUTEX_PRIVATE));
+	} else cont = a_swap(&m->_m_lock, 0);
 	if (robust) {
 		self->robust_list.pending = 0;
 		__vm_unlock_impl();
 	}
-	if (waiters || cont<0)
-		__wake(&m->_m_lock, 1, 0);
+	if ((waiters || cont<0) && !(m->_m_type & 16))
+		__wake(&m->_m_lock, 1, !(m->_m_type&128));
 	return 0;
 }
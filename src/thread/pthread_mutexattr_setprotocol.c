@@ -1,7 +1,29 @@
 #include "pthread_impl.h"
 
+static volatile int check_pi_result = -1;
+
 int pthread_mutexattr_setprotocol(pthread_mutexattr_t *a, int protocol)
 {
-	if (protocol) return ENOTSUP;
-	return 0;
+	int r;
+	switch (protocol) {
+	case PTHREAD_PRIO_NONE:
+		a->__attr &= ~8;
+		return 0;
+	case PTHREAD_PRIO_INHERIT:
+		/* Kernels may be built without PI futexes */
+		r = check_pi_result;
+		if (r < 0) {
+			volatile int lk = 0;
+			r = -__syscall(SYS_futex, &lk, FUTEX_LOCK_PI|FUTEX_PRIVATE, 0, 0);
+			if (r) r = ENOTSUP;
+			a_store(&check_pi_result, r);
+		}
+		if (r) return r;
+		a->__attr |= 8;
+		return 0;
+	case PTHREAD_PRIO_PROTECT:
+		return ENOTSUP;
+	default:
+		return EINVAL;
+	}
 }
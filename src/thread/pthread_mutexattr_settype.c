@@ -2,7 +2,7 @@
 
 int pthread_mutexattr_settype(pthread_mutexattr_t *a, int type)
 {
-	if ((unsigned)type > 2) return EINVAL;
+	if ((unsigned)type > 3) return EINVAL;
 	a->__attr = (a->__attr & ~3) | type;
 	return 0;
 }
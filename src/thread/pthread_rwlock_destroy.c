@@ -1,6 +1,8 @@
 #include "pthread_impl.h"
+#include <stdlib.h>
 
 int pthread_rwlock_destroy(pthread_rwlock_t *rw)
 {
+	free(rw->_rw_slots);
 	return 0;
 }
@@ -0,0 +1,105 @@
+#include "pthread_impl.h"
+
+/* Rwlocks of kind PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP count
+ * readers in RW_SLOTS counters, each on its own cache line, chosen by
+ * the reader's tid, so readers on different cores rarely share a line.
+ * _rw_lock is nonzero while a writer holds or waits for the lock: new
+ * readers back out of their slot and wait while it is, and the writer
+ * waits for every slot to drain, which gives writers preference. */
+
+static volatile int *slot(pthread_rwlock_t *rw)
+{
+	return (volatile int *)rw->_rw_slots + RW_SLOT_INTS*(pthread_self()->tid % RW_SLOTS);
+}
+
+static void leave(pthread_rwlock_t *rw, volatile int *s)
+{
+	if (a_fetch_add(s, -1)==1 && rw->_rw_lock)
+		__wake(s, 1, 1);
+}
+
+int __rwlock_dist_tryrdlock(pthread_rwlock_t *rw)
+{
+	volatile int *s = slot(rw);
+	a_inc(s);
+	if (!rw->_rw_lock) return 0;
+	leave(rw, s);
+	return EBUSY;
+}
+
+int __rwlock_dist_timedrdlock(pthread_rwlock_t *restrict rw, const struct timespec *restrict at)
+{
+	int r, t;
+	while ((r=__rwlock_dist_tryrdlock(rw))==EBUSY) {
+		if (!(r=rw->_rw_lock)) continue;
+		t = r | 0x80000000;
+		a_inc(&rw->_rw_waiters);
+		a_cas(&rw->_rw_lock, r, t);
+		r = __timedwait(&rw->_rw_lock, t, CLOCK_REALTIME, at, 0, 0, 1);
+		a_dec(&rw->_rw_waiters);
+		if (r && r != EINTR) return r;
+	}
+	return r;
+}
+
+static void release(pthread_rwlock_t *rw)
+{
+	int waiters = rw->_rw_waiters;
+	rw->_rw_owner = 0;
+	if (a_swap(&rw->_rw_lock, 0)<0 || waiters)
+		__wake(&rw->_rw_lock, -1, 1);
+}
+
+/* With _rw_lock held, waits for the readers already inside to leave */
+static int drain(pthread_rwlock_t *restrict rw, const struct timespec *restrict at)
+{
+	volatile int *s = (volatile int *)rw->_rw_slots;
+	int i, v, r;
+	for (i=0; i<RW_SLOTS; i++, s+=RW_SLOT_INTS) {
+		while ((v=*s)) {
+			r = __timedwait(s, v, CLOCK_REALTIME, at, 0, 0, 1);
+			if (r && r != EINTR) {
+				release(rw);
+				return r;
+			}
+		}
+	}
+	rw->_rw_owner = pthread_self()->tid;
+	return 0;
+}
+
+int __rwlock_dist_trywrlock(pthread_rwlock_t *rw)
+{
+	volatile int *s = (volatile int *)rw->_rw_slots;
+	int i;
+	if (a_cas(&rw->_rw_lock, 0, 0x7fffffff)) return EBUSY;
+	for (i=0; i<RW_SLOTS; i++, s+=RW_SLOT_INTS) {
+		if (*s) {
+			release(rw);
+			return EBUSY;
+		}
+	}
+	rw->_rw_owner = pthread_self()->tid;
+	return 0;
+}
+
+int __rwlock_dist_timedwrlock(pthread_rwlock_t *restrict rw, const struct timespec *restrict at)
+{
+	int r, t;
+	while ((r=a_cas(&rw->_rw_lock, 0, 0x7fffffff))) {
+		t = r | 0x80000000;
+		a_inc(&rw->_rw_waiters);
+		a_cas(&rw->_rw_lock, r, t);
+		r = __timedwait(&rw->_rw_lock, t, CLOCK_REALTIME, at, 0, 0, 1);
+		a_dec(&rw->_rw_waiters);
+		if (r && r != EINTR) return r;
+	}
+	return drain(rw, at);
+}
+
+int __rwlock_dist_unlock(pthread_rwlock_t *rw)
+{
+	if (rw->_rw_owner == pthread_self()->tid) release(rw);
+	else leave(rw, slot(rw));
+	return 0;
+}
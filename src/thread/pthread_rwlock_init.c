@@ -1,9 +1,17 @@
+#define _GNU_SOURCE
 #include "pthread_impl.h"
+#include <stdlib.h>
 
 int pthread_rwlock_init(pthread_rwlock_t *restrict rw, const pthread_rwlockattr_t *restrict a)
 {
 	*rw = (pthread_rwlock_t){0};
-	if (a) {
+	if (a) rw->_rw_shared = a->__attr[0];
+	/* Reader slots live in this process's heap, so shared
+	 * rwlocks keep the single counter. */
+	if (a && a->__attr[1] == PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+	 && !a->__attr[0]) {
+		rw->_rw_slots = calloc(RW_SLOTS, RW_SLOT_INTS*sizeof(int));
+		if (!rw->_rw_slots) return ENOMEM;
 	}
 	return 0;
 }
@@ -3,6 +3,8 @@
 int pthread_rwlock_tryrdlock(pthread_rwlock_t *rw)
 {
 	int val, cnt;
+	if (rw->_rw_slots) return __rwlock_dist_tryrdlock(rw);
+
 	do {
 		val = rw->_rw_lock;
 		cnt = val & 0x7fffffff;
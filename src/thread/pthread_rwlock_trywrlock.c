@@ -2,6 +2,7 @@
 
 int pthread_rwlock_trywrlock(pthread_rwlock_t *rw)
 {
+	if (rw->_rw_slots) return __rwlock_dist_trywrlock(rw);
 	if (a_cas(&rw->_rw_lock, 0, 0x7fffffff)) return EBUSY;
 	return 0;
 }
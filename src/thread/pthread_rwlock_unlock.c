@@ -4,6 +4,8 @@ int pthread_rwlock_unlock(pthread_rwlock_t *rw)
 {
 	int val, cnt, waiters, new;
 
+	if (rw->_rw_slots) return __rwlock_dist_unlock(rw);
+
 	do {
 		val = rw->_rw_lock;
 		cnt = val & 0x7fffffff;
@@ -12,7 +14,7 @@ int pthread_rwlock_unlock(pthread_rwlock_t *rw)
 	} while (a_cas(&rw->_rw_lock, val, new) != val);
 
 	if (!new && (waiters || val<0))
-		__wake(&rw->_rw_lock, cnt, 0);
+		__wake(&rw->_rw_lock, cnt, !rw->_rw_shared);
 
 	return 0;
 }
@@ -0,0 +1,27 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "pthread_impl.h"
+
+int pthread_setattr_default_np(const pthread_attr_t *attrp)
+{
+	pthread_attr_t a = *attrp;
+
+	/* Only the stack and guard sizes have process-wide defaults */
+	a._a_stacksize = a._a_guardsize = 0;
+	if (memcmp(&a, &(pthread_attr_t){0}, sizeof a))
+		return EINVAL;
+
+	__inhibit_ptc();
+	__default_attr._a_stacksize = attrp->_a_stacksize;
+	__default_attr._a_guardsize = attrp->_a_guardsize;
+	__release_ptc();
+	return 0;
+}
+
+int pthread_getattr_default_np(pthread_attr_t *attrp)
+{
+	__acquire_ptc();
+	*attrp = __default_attr;
+	__release_ptc();
+	return 0;
+}
@@ -6,7 +6,7 @@ int pthread_setspecific(pthread_key_t k, const void *x)
 	/* Avoid unnecessary COW */
 	if (self->tsd[k] != x) {
 		self->tsd[k] = (void *)x;
-		self->tsd_used = 1;
+		self->tsd_used[k/32] |= 1U<<k%32;
 	}
 	return 0;
 }
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include "pthread_impl.h"
 
 int pthread_spin_init(pthread_spinlock_t *s, int shared)
 {
-	return *s = 0;
+	*s = shared & PTHREAD_SPIN_TICKET_NP ? SPIN_TICKET : 0;
+	return 0;
 }
@@ -2,6 +2,20 @@
 
 int pthread_spin_lock(pthread_spinlock_t *s)
 {
-	while (a_swap(s, 1)) a_spin();
+	unsigned t, c;
+	int n, i = 0;
+	if (!(*s & SPIN_TICKET)) {
+		while (a_swap(s, 1)) a_spin();
+		return 0;
+	}
+	t = (unsigned)a_fetch_add(s, SPIN_NEXT) >> 17;
+	/* Back off in proportion to the number of waiters ahead */
+	while ((n = (t - (c = *s)) & 0x7fff)) {
+		while (n--) a_spin();
+		/* Tickets are served in order, so a preempted thread ahead
+		 * cannot be spun past; yield once the line stops moving. */
+		if ((*s ^ c) & 0x7fff) i = 0;
+		else if (++i > 100) __syscall(SYS_sched_yield);
+	}
 	return 0;
 }
@@ -2,5 +2,9 @@
 
 int pthread_spin_trylock(pthread_spinlock_t *s)
 {
-	return -a_swap(s, 1) & EBUSY;
+	int v = *s;
+	if (!(v & SPIN_TICKET))
+		return -a_swap(s, 1) & EBUSY;
+	if ((((unsigned)v >> 17) - v) & 0x7fff) return EBUSY;
+	return a_cas(s, v, (int)((unsigned)v+SPIN_NEXT)) == v ? 0 : EBUSY;
 }
@@ -2,6 +2,14 @@
 
 int pthread_spin_unlock(pthread_spinlock_t *s)
 {
-	a_store(s, 0);
+	int v;
+	if (!(*s & SPIN_TICKET)) {
+		a_store(s, 0);
+		return 0;
+	}
+	/* Waiters take tickets concurrently, so the served count must
+	 * be advanced without carrying into the rest of the word. */
+	do v = *s;
+	while (a_cas(s, v, (v & ~0x7fff) | ((unsigned)v+1 & 0x7fff)) != v);
 	return 0;
 }
@@ -1,5 +1,7 @@
 #include <time.h>
 #include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
 #include "pthread_impl.h"
 
 struct ksigevent {
@@ -78,6 +80,280 @@ static void *start(void *arg)
 	return 0;
 }
 
+/* SIGEV_THREAD timers without notify attributes do not get a thread
+ * each. Their kernel timers all send SIGTIMER to one dispatcher thread,
+ * which hands expirations to a small pool of workers that run the
+ * callbacks. A timer runs at most one callback at a time; expirations
+ * that arrive while it is queued or running are counted as overruns of
+ * its next notification, as the kernel counts them for a timer whose
+ * signal is still pending.
+ *
+ * The signal names its timer by a slot in the service's table and a
+ * generation, never by address. A signal still queued when its timer
+ * is deleted finds no timer or one with a different key and is
+ * dropped, and one forged by another process can at worst pass for an
+ * expiration. */
+
+#define MAX_WORKERS 4
+#define SLOT_BITS (sizeof(uintptr_t)*4)
+#define SLOT_MASK (((uintptr_t)1<<SLOT_BITS)-1)
+
+enum {
+	IDLE,
+	QUEUED,
+	RUNNING,
+	DEAD = 4,
+};
+
+static struct {
+	volatile int lock[2];
+	volatile int seq;
+	int workers, idle;
+	struct __timer *head, *tail;
+	pthread_t dispatcher;
+	struct __timer **slots;
+	size_t nslots;
+	uintptr_t gen;
+} svc;
+
+static int spawn(void *(*fn)(void *), int all)
+{
+	pthread_t td;
+	pthread_attr_t attr;
+	sigset_t set;
+	int r;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (all) __block_all_sigs(&set);
+	else __block_app_sigs(&set);
+	r = pthread_create(&td, &attr, fn, 0);
+	__restore_sigs(&set);
+	if (all && !r) svc.dispatcher = td;
+	return r;
+}
+
+static void *work(void *);
+
+static void wake()
+{
+	if (svc.idle) __wake(&svc.seq, 1, 1);
+	else if (svc.workers < MAX_WORKERS && !spawn(work, 0)) svc.workers++;
+}
+
+static void queue(struct __timer *t)
+{
+	t->state = QUEUED;
+	t->next = 0;
+	if (svc.tail) svc.tail->next = t;
+	else svc.head = t;
+	svc.tail = t;
+	svc.seq++;
+	wake();
+}
+
+static int add(int a, long long b)
+{
+	return a+b > DELAYTIMER_MAX ? DELAYTIMER_MAX : a+b;
+}
+
+static void finish(struct __timer *t)
+{
+	if (t->state & DEAD) {
+		free(t);
+	} else if (t->pending) {
+		t->overrun = t->pending-1;
+		t->pending = 0;
+		queue(t);
+	} else {
+		t->state = IDLE;
+	}
+}
+
+static void cleanup(void *p)
+{
+	LOCK(svc.lock);
+	finish(p);
+	svc.workers--;
+	if (svc.head) wake();
+	UNLOCK(svc.lock);
+}
+
+static void *work(void *arg)
+{
+	pthread_t self = __pthread_self();
+	struct __timer *t;
+	int seq;
+
+	LOCK(svc.lock);
+	for (;;) {
+		while (!(t = svc.head)) {
+			seq = svc.seq;
+			svc.idle++;
+			UNLOCK(svc.lock);
+			__wait(&svc.seq, 0, seq, 1);
+			LOCK(svc.lock);
+			svc.idle--;
+		}
+		/* An idle worker counts as such until it runs, so several
+		 * queued callbacks may all have woken just this one. */
+		if (!(svc.head = t->next)) svc.tail = 0;
+		else wake();
+		if (t->state & DEAD) {
+			finish(t);
+			continue;
+		}
+		t->state = RUNNING;
+		UNLOCK(svc.lock);
+
+		/* Exiting or being cancelled from the callback only ends
+		 * this worker. Otherwise each callback starts as though on
+		 * a thread of its own. */
+		pthread_cleanup_push(cleanup, t);
+		t->notify(t->val);
+		pthread_cleanup_pop(0);
+		__pthread_tsd_run_dtors(self);
+		__reset_tls();
+
+		LOCK(svc.lock);
+		finish(t);
+	}
+	return 0;
+}
+
+static struct __timer *lookup(uintptr_t key)
+{
+	struct __timer *t;
+	if ((key & SLOT_MASK) >= svc.nslots) return 0;
+	t = svc.slots[key & SLOT_MASK];
+	return t && t->key == key ? t : 0;
+}
+
+static void *dispatch(void *arg)
+{
+	siginfo_t si;
+	struct __timer *t;
+
+	for (;;) {
+		if (__syscall(SYS_rt_sigtimedwait, SIGTIMER_SET, &si, 0,
+		    _NSIG/8) != SIGTIMER || si.si_code != SI_TIMER)
+			continue;
+		LOCK(svc.lock);
+		if ((t = lookup((uintptr_t)si.si_value.sival_ptr))) switch (t->state) {
+		case IDLE:
+			t->overrun = si.si_timer2;
+			queue(t);
+			break;
+		case QUEUED:
+			t->overrun = add(t->overrun, 1LL + si.si_timer2);
+			break;
+		case RUNNING:
+			t->pending = add(t->pending, 1LL + si.si_timer2);
+			break;
+		}
+		UNLOCK(svc.lock);
+	}
+	return 0;
+}
+
+static int attach(struct __timer *t)
+{
+	struct __timer **new;
+	size_t i, n;
+
+	for (i=0; i<svc.nslots && svc.slots[i]; i++);
+	if (i == svc.nslots) {
+		n = svc.nslots ? 2*svc.nslots : 16;
+		if (n > SLOT_MASK+1) n = SLOT_MASK+1;
+		if (i == n) return EAGAIN;
+		if (!(new = realloc(svc.slots, n * sizeof *new))) return EAGAIN;
+		memset(new+i, 0, (n-i) * sizeof *new);
+		svc.slots = new;
+		svc.nslots = n;
+	}
+	t->key = ++svc.gen << SLOT_BITS | i;
+	svc.slots[i] = t;
+	return 0;
+}
+
+/* A timer a worker still holds is freed by that worker. */
+void __timer_delete_shared(struct __timer *t)
+{
+	__syscall(SYS_timer_delete, t->timerid);
+	LOCK(svc.lock);
+	svc.slots[t->key & SLOT_MASK] = 0;
+	if (t->state == IDLE) free(t);
+	else t->state |= DEAD;
+	UNLOCK(svc.lock);
+}
+
+int __timer_getoverrun_shared(struct __timer *t)
+{
+	int r;
+	LOCK(svc.lock);
+	r = t->overrun;
+	UNLOCK(svc.lock);
+	return r;
+}
+
+static void prepare_fork()
+{
+	LOCK(svc.lock);
+}
+
+static void parent_fork()
+{
+	UNLOCK(svc.lock);
+}
+
+/* The child has no timers and none of the service's threads */
+static void child_fork()
+{
+	memset((void *)&svc, 0, sizeof svc);
+}
+
+static int timer_create_shared(clockid_t clk, struct sigevent *evp, timer_t *res)
+{
+	static int registered;
+	struct __timer *t;
+	struct ksigevent ksev;
+	int r = 0;
+
+	if (!(t = malloc(sizeof *t))) return -1;
+	*t = (struct __timer){
+		.notify = evp->sigev_notify_function,
+		.val = evp->sigev_value,
+	};
+
+	LOCK(svc.lock);
+	if (!registered && !(r = pthread_atfork(prepare_fork, parent_fork, child_fork)))
+		registered = 1;
+	if (!r && !svc.dispatcher) r = spawn(dispatch, 1);
+	if (!r) r = attach(t);
+	if (!r) {
+		ksev.sigev_value.sival_ptr = (void *)t->key;
+		ksev.sigev_signo = SIGTIMER;
+		ksev.sigev_notify = 4; /* SIGEV_THREAD_ID */
+		ksev.sigev_tid = svc.dispatcher->tid;
+	}
+	UNLOCK(svc.lock);
+
+	if (r) {
+		free(t);
+		errno = r < 0 ? ENOMEM : r;
+		return -1;
+	}
+	if (syscall(SYS_timer_create, clk, &ksev, &t->timerid) < 0) {
+		LOCK(svc.lock);
+		svc.slots[t->key & SLOT_MASK] = 0;
+		UNLOCK(svc.lock);
+		free(t);
+		return -1;
+	}
+	*res = (void *)(INTPTR_MIN | (uintptr_t)t>>1 | 1);
+	return 0;
+}
+
 int timer_create(clockid_t clk, struct sigevent *restrict evp, timer_t *restrict res)
 {
 	static pthread_once_t once = PTHREAD_ONCE_INIT;
@@ -104,11 +380,10 @@ int timer_create(clockid_t clk, struct sigevent *restrict evp, timer_t *restrict
 		*res = (void *)(intptr_t)timerid;
 		break;
 	case SIGEV_THREAD:
+		if (!evp->sigev_notify_attributes)
+			return timer_create_shared(clk, evp, res);
 		pthread_once(&once, install_handler);
-		if (evp->sigev_notify_attributes)
-			attr = *evp->sigev_notify_attributes;
-		else
-			pthread_attr_init(&attr);
+		attr = *evp->sigev_notify_attributes;
 		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 		pthread_barrier_init(&args.b, 0, 2);
 		args.sev = evp;
@@ -2,8 +2,14 @@
 #include <limits.h>
 #include "pthread_impl.h"
 
+void __timer_delete_shared(struct __timer *);
+
 int timer_delete(timer_t t)
 {
+	if ((intptr_t)t < 0 && (uintptr_t)t & 1) {
+		__timer_delete_shared((void *)((uintptr_t)t << 1 & -4));
+		return 0;
+	}
 	if ((intptr_t)t < 0) {
 		pthread_t td = (void *)((uintptr_t)t << 1);
 		a_store(&td->timer_id, td->timer_id | INT_MIN);
@@ -2,8 +2,12 @@
 #include <limits.h>
 #include "pthread_impl.h"
 
+int __timer_getoverrun_shared(struct __timer *);
+
 int timer_getoverrun(timer_t t)
 {
+	if ((intptr_t)t < 0 && (uintptr_t)t & 1)
+		return __timer_getoverrun_shared((void *)((uintptr_t)t << 1 & -4));
 	if ((intptr_t)t < 0) {
 		pthread_t td = (void *)((uintptr_t)t << 1);
 		t = (void *)(uintptr_t)(td->timer_id & INT_MAX);
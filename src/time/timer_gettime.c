@@ -4,7 +4,10 @@
 
 int timer_gettime(timer_t t, struct itimerspec *val)
 {
-	if ((intptr_t)t < 0) {
+	if ((intptr_t)t < 0 && (uintptr_t)t & 1) {
+		struct __timer *p = (void *)((uintptr_t)t << 1 & -4);
+		t = (void *)(uintptr_t)p->timerid;
+	} else if ((intptr_t)t < 0) {
 		pthread_t td = (void *)((uintptr_t)t << 1);
 		t = (void *)(uintptr_t)(td->timer_id & INT_MAX);
 	}